@@ -0,0 +1,237 @@
+/* CRTP - Barton-Nackman Trick with expression templates
+ *
+ * static polymorphism, design pattern, expression templates, lazy evaluation, loop fusion, performance
+ *
+ * motivation: CRTP_BartonNackmannTrick.cpp
+ *
+ * The `Addition` and `Multiplication` mixins of CRTP_BartonNackmannTrick.cpp
+ * return a new `T` from every operator, so `a + b * c + d` materializes
+ * `b * c` and `a + b * c` before the final result, each with its own loop
+ * (and, for large tuples, its own allocation).
+ * Here the operators return lightweight expression nodes that only remember
+ * their operands. Nothing is computed until the expression is assigned to a
+ * `Vector`, which evaluates the whole expression in a single fused loop:
+ * `result[i] = a[i] + b[i] * c[i] + d[i]`.
+ * Opting in works as before: the operators are hidden friends of the mixins,
+ * found by ADL because every expression carries its result type `T` (and
+ * thereby the mixins of `T`) as template argument. A `Point` still can't be
+ * added, and a `Vector` with `Addition` only can't be multiplied.
+ * Nodes store the tuples they refer to by reference and sub-expressions by
+ * value, so `auto e = a + b * c;` is fine as long as `a`, `b` and `c` live.
+ *
+ * compile using `g++ --std=c++20 -O3`
+ */
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = std::chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+//---------------------------------------------------------------------------------------------Tuple
+
+// small tuples live in place, large ones on the heap
+template <typename T, std::size_t N>
+struct Tuple {
+    static constexpr std::size_t size = N;
+    using value_type = T;
+
+    Tuple() { if constexpr (onHeap) data_.resize(N); }
+    template <typename... Ts>
+        requires (sizeof...(Ts) == N && N > 1)
+    Tuple( Ts... vs ) : data_{ static_cast<T>(vs)... } {}
+
+    T      & operator[]( std::size_t index )       { return data_[index]; }
+    T const& operator[]( std::size_t index ) const { return data_[index]; }
+private:
+    static constexpr bool onHeap = N > 16;
+    std::conditional_t<onHeap, std::vector<T>, std::array<T, N>> data_;
+};
+
+template <typename T, std::size_t N>
+std::ostream & operator<<(std::ostream& out, Tuple<T, N> const & t) {
+    for (auto i = std::size_t{0}; i < N; ++i) out << (i ? " " : "") << t[i];
+    return out;
+}
+
+//----------------------------------------------------------------------------------------Expression
+
+// `E` is the concrete expression, `Result` the type it evaluates to
+template <typename E, typename Result>
+struct Expression {
+    E const & self() const { return static_cast<E const &>(*this); }
+};
+
+template <typename E>
+concept Node = requires { E::isNode; };
+
+template <typename L, typename R, typename Result, typename Op>
+struct BinaryExpression : Expression<BinaryExpression<L, R, Result, Op>, Result> {
+    static constexpr bool isNode = true;
+
+    BinaryExpression( L const & l, R const & r ) : lhs{l}, rhs{r} {}
+    auto operator[]( std::size_t index ) const { return Op{}(lhs[index], rhs[index]); }
+
+    std::conditional_t<Node<L>, L, L const &> lhs;
+    std::conditional_t<Node<R>, R, R const &> rhs;
+};
+
+template <typename E, typename Result>
+    requires Node<E>
+std::ostream & operator<<(std::ostream& out, Expression<E, Result> const & e) {
+    return out << Result{e.self()};
+}
+
+// ---------------------------------------------------------Barton-Nackman-Trick
+
+template< typename T >
+struct Addition {
+    template <typename L, typename R>
+    friend auto operator+( Expression<L, T> const & lhs, Expression<R, T> const & rhs ) {
+        return BinaryExpression<L, R, T, std::plus<>>{lhs.self(), rhs.self()};
+    }
+};
+
+template< typename T >
+struct Multiplication {
+    template <typename L, typename R>
+    friend auto operator*( Expression<L, T> const & lhs, Expression<R, T> const & rhs ) {
+        return BinaryExpression<L, R, T, std::multiplies<>>{lhs.self(), rhs.self()};
+    }
+};
+
+// -------------------------------------------------Eager Barton-Nackman-Trick
+// CRTP_BartonNackmannTrick.cpp for any N, for comparison
+
+template< typename T >
+struct EagerAddition {
+    friend T operator+( T const & lhs, T const & rhs ) {
+        auto result = T{};
+        for (auto i = std::size_t{0}; i < T::size; ++i) result[i] = lhs[i] + rhs[i];
+        return result;
+    }
+};
+
+template< typename T >
+struct EagerMultiplication {
+    friend T operator*( T const & lhs, T const & rhs ) {
+        auto result = T{};
+        for (auto i = std::size_t{0}; i < T::size; ++i) result[i] = lhs[i] * rhs[i];
+        return result;
+    }
+};
+
+// --------------------------------------------------Mix and Match Functionality
+
+template <typename T, std::size_t N>
+struct Vector : Tuple<T, N>, Expression<Vector<T, N>, Vector<T, N>>,
+                Addition<Vector<T, N>>, Multiplication<Vector<T, N>> {
+    using Tuple<T, N>::Tuple;
+    Vector() = default;
+
+    // evaluate, in a single loop
+    template <typename E>
+    Vector( Expression<E, Vector> const & e ) { *this = e; }
+
+    template <typename E>
+    Vector & operator=( Expression<E, Vector> const & e ) {
+        auto const & expression = e.self();
+        for (auto i = std::size_t{0}; i < N; ++i) (*this)[i] = expression[i];
+        return *this;
+    }
+};
+
+template <typename T, std::size_t N>
+struct AddableVector : Tuple<T, N>, Expression<AddableVector<T, N>, AddableVector<T, N>>,
+                       Addition<AddableVector<T, N>> {
+    using Tuple<T, N>::Tuple;
+    AddableVector() = default;
+
+    template <typename E>
+    AddableVector( Expression<E, AddableVector> const & e ) {
+        for (auto i = std::size_t{0}; i < N; ++i) (*this)[i] = e.self()[i];
+    }
+};
+
+template <typename T, std::size_t N>
+struct Point : Tuple<T, N>, Expression<Point<T, N>, Point<T, N>> {
+    using Tuple<T, N>::Tuple;
+};
+
+template <typename T, std::size_t N>
+struct EagerVector : Tuple<T, N>, EagerAddition<EagerVector<T, N>>, EagerMultiplication<EagerVector<T, N>> {
+    using Tuple<T, N>::Tuple;
+    EagerVector() = default;
+};
+
+// ---------------------------------------------------------------------------------------------Try It
+
+template <typename V>
+auto benchmark(char const * name, int repetitions) {
+    auto a = V{}, b = V{}, c = V{}, d = V{}, result = V{};
+    for (auto i = std::size_t{0}; i < V::size; ++i) {
+        a[i] = double(i % 7); b[i] = double(i % 5); c[i] = 0.5; d[i] = 1.0;
+    }
+    auto checksum = 0.0;
+    {
+        ScopedTimer t{name};
+        for (auto repetition = 0; repetition < repetitions; ++repetition) {
+            result = a + b * c + d;
+            checksum += result[repetition % V::size];
+            a[repetition % V::size] += 1;  // so the loop is not hoisted
+        }
+    }
+    return checksum;
+}
+
+int main () {
+    Vector<int, 3> v1{ 1,2,3 };
+    Vector<int, 3> v2{ 1,2,3 };
+    Point<int, 3> p1{ 1,2,3 };
+
+    std::cout << v1 + v2 << std::endl;            // 2 4 6
+    std::cout << v1 * v2 << std::endl;            // 1 4 9
+    std::cout << v1 + v2 * v2 + v1 << std::endl;  // 3 8 15
+    //std::cout << p1 + p1 << std::endl; // compile-time error, point and point cannot be added :D
+    //std::cout << v1 + p1 << std::endl; // compile-time error, vector and point neither
+    std::cout << p1 << std::endl;
+
+    AddableVector<int, 3> a1{ 1,2,3 };
+    std::cout << a1 + a1 + a1 << std::endl;       // 3 6 9
+    //std::cout << a1 * a1 << std::endl; // compile-time error, no Multiplication mixin
+
+    // large N: the eager version allocates and loops 3 times, the lazy one once
+    std::cout << benchmark<EagerVector<double, 1'000'000>>("eager, N = 1'000'000", 200) << '\n';  // 12181583us, -O3: 1914144us
+    std::cout << benchmark<Vector<double, 1'000'000>>("lazy,  N = 1'000'000", 200) << '\n';       // 11082854us, -O3:  641146us
+    // small N: no allocations, both unrolled at -O3
+    std::cout << benchmark<EagerVector<double, 3>>("eager, N = 3", 10'000'000) << '\n';           //  2571374us, -O3:  120309us
+    std::cout << benchmark<Vector<double, 3>>("lazy,  N = 3", 10'000'000) << '\n';                //  2394723us, -O3:  109368us
+}
@@ -0,0 +1,415 @@
+/* CRTP - Barton-Nackman Trick with SIMD
+ *
+ * static polymorphism, design pattern, SIMD, intrinsics, SSE, AVX, alignment, index sequence, performance
+ *
+ * motivation: CRTP_BartonNackmannTrick.cpp, Alignment.cpp
+ *
+ * The `Tuple` of CRTP_BartonNackmannTrick.cpp holds exactly three `int`s and
+ * the mixins spell out `[0]`, `[1]`, `[2]`. Here `Tuple<T, N>` holds `N`
+ * values of any arithmetic type. If the next power of two of lanes fits one
+ * register (at most 32 bytes, e.g. 3 -> 4 floats), the tuple is padded with
+ * zeros and aligned to its size, so that a `Tuple<float, 3>` is exactly one
+ * SSE register and a `Tuple<double, 4>` exactly one AVX register. Larger
+ * tuples are not padded, a `Tuple<double, 5>` would grow from 40 to 64 bytes.
+ * The mixins apply the operation to all lanes. If there is an instruction
+ * for the type and number of lanes (depending on what the compiler is allowed
+ * to use, see `-march`), it is a single load/op/store via intrinsics,
+ * otherwise a fold over `std::index_sequence`, which unrolls at compile time.
+ * `ScalarAddition`/`ScalarMultiplication` use the index sequence only, to
+ * compare with the same layout.
+ * One tuple per instruction is the best a single tuple can get, but for
+ * arrays of tuples it is not: with -O3 -march=native the compiler
+ * vectorizes a loop over plain unpadded structs across neighbouring tuples,
+ * which the intrinsics prevent (see the table at the end). For arrays,
+ * `VectorArray<T, N>` stores the tuples as a structure of arrays, one
+ * contiguous array per component, and `transform` runs the same tuple
+ * expression component by component over all tuples. The inner loops are
+ * over plain `T`s, need neither padding nor intrinsics and vectorize with
+ * any register width. Where the components of one tuple are combined, as in
+ * `dot`, the structure of arrays is clearly ahead: each instruction combines
+ * as many tuples as a register holds `T`s, structs have to be shuffled first.
+ *
+ * compile using `g++ --std=c++20 -O3 -march=native`
+ */
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <span>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = std::chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+//---------------------------------------------------------------------------------------------Tuple
+
+constexpr std::size_t maxRegisterSize = 32;  // AVX
+
+// padded to a power of two only if that fits one register
+template <typename T, std::size_t N>
+constexpr std::size_t paddedLanes = sizeof(T) * std::bit_ceil(N) <= maxRegisterSize ? std::bit_ceil(N) : N;
+
+template <typename T, std::size_t N>
+struct alignas(paddedLanes<T, N> == std::bit_ceil(N) ? sizeof(T) * paddedLanes<T, N> : alignof(T)) Tuple {
+    using value_type = T;
+    static constexpr std::size_t size = N;
+    static constexpr std::size_t lanes = paddedLanes<T, N>;
+
+    Tuple() = default;
+    template <typename... Ts>
+        requires (sizeof...(Ts) == N)
+    Tuple( Ts... vs ) : data_{ static_cast<T>(vs)... } {}  // padding lanes are zero
+
+    T      & operator[]( std::size_t index )       { return data_[index]; }
+    T const& operator[]( std::size_t index ) const { return data_[index]; }
+
+    T      * data()       { return data_.data(); }
+    T const* data() const { return data_.data(); }
+private:
+    std::array<T, lanes> data_{};
+};
+
+template <typename T, std::size_t N>
+std::ostream & operator<<(std::ostream& out, Tuple<T, N> const & t) {
+    for (auto i = std::size_t{0}; i < N; ++i) out << (i ? " " : "") << t[i];
+    return out;
+}
+
+//----------------------------------------------------------------------------------------------SIMD
+// one specialization per type and number of lanes that fits a register
+
+namespace simd {
+
+template <typename T, std::size_t Lanes> struct Register;  // none
+
+#ifdef __SSE__
+template <> struct Register<float, 4> {
+    static __m128 load(float const* p) { return _mm_load_ps(p); }
+    static void store(float* p, __m128 r) { _mm_store_ps(p, r); }
+};
+inline __m128 add(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+inline __m128 mul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+#endif
+
+#ifdef __SSE2__
+template <> struct Register<double, 2> {
+    static __m128d load(double const* p) { return _mm_load_pd(p); }
+    static void store(double* p, __m128d r) { _mm_store_pd(p, r); }
+};
+inline __m128d add(__m128d a, __m128d b) { return _mm_add_pd(a, b); }
+inline __m128d mul(__m128d a, __m128d b) { return _mm_mul_pd(a, b); }
+
+template <> struct Register<int, 4> {
+    static __m128i load(int const* p) { return _mm_load_si128(reinterpret_cast<__m128i const*>(p)); }
+    static void store(int* p, __m128i r) { _mm_store_si128(reinterpret_cast<__m128i*>(p), r); }
+};
+inline __m128i add(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+#endif
+
+#ifdef __SSE4_1__
+inline __m128i mul(__m128i a, __m128i b) { return _mm_mullo_epi32(a, b); }
+#endif
+
+#ifdef __AVX__
+template <> struct Register<float, 8> {
+    static __m256 load(float const* p) { return _mm256_load_ps(p); }
+    static void store(float* p, __m256 r) { _mm256_store_ps(p, r); }
+};
+inline __m256 add(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+inline __m256 mul(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+
+template <> struct Register<double, 4> {
+    static __m256d load(double const* p) { return _mm256_load_pd(p); }
+    static void store(double* p, __m256d r) { _mm256_store_pd(p, r); }
+};
+inline __m256d add(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+inline __m256d mul(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+#endif
+
+template <typename T, std::size_t Lanes, typename VectorizedOp>
+concept Available = requires (T const* p, VectorizedOp op) {
+    op(Register<T, Lanes>::load(p), Register<T, Lanes>::load(p));
+};
+
+}  // namespace simd
+
+// `result[i] = op(lhs[i], rhs[i])` for all lanes, unrolled at compile time
+template <typename T, typename ScalarOp, std::size_t... I>
+T elementwise( T const & lhs, T const & rhs, ScalarOp op, std::index_sequence<I...> ) {
+    auto result = T{};
+    ((result[I] = op(lhs[I], rhs[I])), ...);
+    return result;
+}
+
+template <typename T, typename ScalarOp, typename VectorizedOp>
+T lanewise( T const & lhs, T const & rhs, ScalarOp scalarOp, VectorizedOp vectorizedOp ) {
+    using Value = typename T::value_type;
+    if constexpr (simd::Available<Value, T::lanes, VectorizedOp>) {
+        using Register = simd::Register<Value, T::lanes>;
+        auto result = T{};
+        Register::store(result.data(), vectorizedOp(Register::load(lhs.data()), Register::load(rhs.data())));
+        return result;
+    }
+    else return elementwise(lhs, rhs, scalarOp, std::make_index_sequence<T::lanes>{});
+}
+
+// ---------------------------------------------------------Barton-Nackman-Trick
+
+template< typename T >
+struct Addition {
+    friend T operator+( T const & lhs, T const & rhs ) {
+        return lanewise(lhs, rhs, std::plus<>{}, [](auto a, auto b) -> decltype(simd::add(a, b)) { return simd::add(a, b); });
+    }
+};
+
+template< typename T >
+struct Multiplication {
+    friend T operator*( T const & lhs, T const & rhs ) {
+        return lanewise(lhs, rhs, std::multiplies<>{}, [](auto a, auto b) -> decltype(simd::mul(a, b)) { return simd::mul(a, b); });
+    }
+};
+
+template< typename T >
+struct ScalarAddition {
+    friend T operator+( T const & lhs, T const & rhs ) {
+        return elementwise(lhs, rhs, std::plus<>{}, std::make_index_sequence<T::lanes>{});
+    }
+};
+
+template< typename T >
+struct ScalarMultiplication {
+    friend T operator*( T const & lhs, T const & rhs ) {
+        return elementwise(lhs, rhs, std::multiplies<>{}, std::make_index_sequence<T::lanes>{});
+    }
+};
+
+// --------------------------------------------------Mix and Match Functionality
+
+template <typename T, std::size_t N>
+struct Vector : Tuple<T, N>, Addition<Vector<T, N>>, Multiplication<Vector<T, N>> {
+    using Tuple<T, N>::Tuple;
+};
+
+template <typename T, std::size_t N>
+struct ScalarVector : Tuple<T, N>, ScalarAddition<ScalarVector<T, N>>, ScalarMultiplication<ScalarVector<T, N>> {
+    using Tuple<T, N>::Tuple;
+};
+
+template <typename T, std::size_t N>
+struct Point : Tuple<T, N> {
+    using Tuple<T, N>::Tuple;
+};
+
+// as in CRTP_BartonNackmannTrick.cpp, unpadded
+struct Vector3f {
+    float x, y, z;
+    friend Vector3f operator+( Vector3f const & l, Vector3f const & r ) { return {l.x + r.x, l.y + r.y, l.z + r.z}; }
+    friend Vector3f operator*( Vector3f const & l, Vector3f const & r ) { return {l.x * r.x, l.y * r.y, l.z * r.z}; }
+};
+
+// -------------------------------------------------------------------------------Structure of Arrays
+
+// `N` arrays of `T`, the i-th tuple is made of the i-th element of each
+template <typename T, std::size_t N>
+class VectorArray {
+public:
+    explicit VectorArray( std::size_t size, Vector<T, N> const & value = {} )
+        : size_{size}, components_(N * size) {
+        for (auto k = std::size_t{0}; k < N; ++k) std::fill_n(component(k), size, value[k]);
+    }
+
+    std::size_t size() const { return size_; }
+    T      * component( std::size_t k )       { return components_.data() + k * size_; }
+    T const* component( std::size_t k ) const { return components_.data() + k * size_; }
+
+    Vector<T, N> operator[]( std::size_t i ) const {
+        return [&]<std::size_t... K>(std::index_sequence<K...>) { return Vector<T, N>{component(K)[i]...}; }
+            (std::make_index_sequence<N>{});
+    }
+
+    void swap( VectorArray & other ) noexcept {
+        std::swap(size_, other.size_);
+        components_.swap(other.components_);
+    }
+
+private:
+    std::size_t size_;
+    std::vector<T> components_;
+};
+
+// out[i] = op(in[i]...), `out` must not overlap any `in`: without `__restrict__` the compiler
+// vectorizes too, but guards the loop with a runtime overlap check per input
+template <typename T, typename Op, typename... In>
+void lanewiseArrays( std::size_t const n, Op op, T * __restrict__ const out, In const * const... in ) {
+    for (auto j = std::size_t{0}; j < n; ++j) out[j] = op(in[j]...);
+}
+
+// result[i] = op(arrays[i]...) for all tuples, evaluated component by component on plain `T`s,
+// `result` must not be one of the `arrays`
+template <typename T, std::size_t N, typename Op, typename... Arrays>
+void transform( VectorArray<T, N> & result, Op op, Arrays const &... arrays ) {
+    assert(((static_cast<void const*>(&result) != &arrays) && ...));
+    for (auto k = std::size_t{0}; k < N; ++k)
+        lanewiseArrays(result.size(), op, result.component(k), arrays.component(k)...);
+}
+
+// out[i] = a[i] . b[i], a reduction over the components of each tuple, which are in different
+// arrays: one pass over the 2N arrays a0, b0, a1, b1, ...
+template <typename T, std::size_t N>
+void dot( VectorArray<T, N> const & a, VectorArray<T, N> const & b, std::span<T> out ) {
+    assert(a.size() == out.size() && b.size() == out.size());
+    auto const sumOfProducts = [](auto const... ab) {
+        T const values[] = {ab...};
+        auto sum = T{};
+        for (auto k = std::size_t{0}; k < N; ++k) sum += values[2 * k] * values[2 * k + 1];
+        return sum;
+    };
+    [&]<std::size_t... K>(std::index_sequence<K...>) {
+        lanewiseArrays(out.size(), sumOfProducts, out.data(), (K % 2 ? b : a).component(K / 2)...);
+    }(std::make_index_sequence<2 * N>{});
+}
+
+// ---------------------------------------------------------------------------------------------Try It
+
+// r = a + b * c for arrays of vectors
+template <typename V>
+void benchmark(char const * name) {
+    constexpr auto n = 4096;  // 4 arrays fit into L2, otherwise memory bandwidth is all we measure
+    auto const make = [](float value) {
+        if constexpr (requires { V{1.f, 2.f, 3.f}; }) return V{value, 2 * value, 3 * value};
+        else return V{value, 2 * value, 3 * value, 4 * value};
+    };
+    auto a = std::vector<V>(n, make(1)), b = std::vector<V>(n, make(0.5)), c = std::vector<V>(n, make(2)),
+         r = std::vector<V>(n);
+    {
+        ScopedTimer t{name};
+        for (auto repetition = 0; repetition < 25'000; ++repetition) {
+            for (auto i = 0; i < n; ++i) r[i] = a[i] + b[i] * c[i];
+            std::swap(a, r);
+        }
+    }
+    std::cout << "  sizeof " << sizeof(V) << ", " << (r[0] + a[n - 1]) << '\n';
+}
+
+// the same, as structure of arrays
+template <typename T, std::size_t N>
+void benchmarkArrays(char const * name) {
+    constexpr auto n = 4096;
+    auto const make = [](T value) {
+        return [&]<std::size_t... I>(std::index_sequence<I...>) { return Vector<T, N>{(I + 1) * value...}; }
+            (std::make_index_sequence<N>{});
+    };
+    auto a = VectorArray<T, N>(n, make(1)), b = VectorArray<T, N>(n, make(0.5)), c = VectorArray<T, N>(n, make(2)),
+         r = VectorArray<T, N>(n);
+    {
+        ScopedTimer t{name};
+        for (auto repetition = 0; repetition < 25'000; ++repetition) {
+            transform(r, [](auto a, auto b, auto c) { return a + b * c; }, a, b, c);
+            a.swap(r);
+        }
+    }
+    std::cout << "  " << (r[0] + a[n - 1]) << '\n';
+}
+
+// dot products of many pairs of vectors, the components of one tuple have to be combined
+void benchmarkDot() {
+    constexpr auto n = 4096;
+    auto const a = std::vector<Vector3f>(n, Vector3f{1, 2, 3}), b = std::vector<Vector3f>(n, Vector3f{0.5, 1, 2});
+    auto const as = VectorArray<float, 3>(n, {1, 2, 3}), bs = VectorArray<float, 3>(n, {0.5, 1, 2});
+    auto out = std::vector<float>(n);
+    auto sum = 0.0f;
+    {
+        ScopedTimer t{"dot products, unpadded float x 3"};
+        for (auto repetition = 0; repetition < 25'000; ++repetition) {
+            for (auto i = 0; i < n; ++i) out[i] = a[i].x * b[i].x + a[i].y * b[i].y + a[i].z * b[i].z;
+            sum += out[repetition % n];
+        }
+    }
+    {
+        ScopedTimer t{"dot products, structure of arrays float x 3"};
+        for (auto repetition = 0; repetition < 25'000; ++repetition) {
+            dot(as, bs, std::span{out});
+            sum += out[repetition % n];
+        }
+    }
+    std::cout << "  " << sum << '\n';  // 2 x 25000 x 8.5
+}
+
+std::ostream & operator<<(std::ostream& out, Vector3f const & v) { return out << v.x << ' ' << v.y << ' ' << v.z; }
+
+int main () {
+    Vector<int, 3> v1{ 1,2,3 };
+    Vector<int, 3> v2{ 1,2,3 };
+    Point<int, 3> p1{ 1,2,3 };
+
+    std::cout << v1 + v2 << std::endl;  // 2 4 6
+    std::cout << v1 * v2 << std::endl;  // 1 4 9
+    //std::cout << p1 + p1 << std::endl; // compile-time error, point and point cannot be added :D
+    std::cout << p1 << std::endl;
+    std::cout << Vector<double, 5>{1, 2, 3, 4, 5} * Vector<double, 5>{1, 2, 3, 4, 5} << std::endl;  // 1 4 9 16 25
+
+    static_assert(sizeof(Vector<float, 3>) == 16 && alignof(Vector<float, 3>) == 16);
+    static_assert(sizeof(Vector<double, 4>) == 32 && alignof(Vector<double, 4>) == 32);
+    static_assert(sizeof(Vector<double, 5>) == 40 && alignof(Vector<double, 5>) == 8);  // not padded to 64
+
+    benchmark<Vector3f>("unpadded float x 3");
+    benchmark<ScalarVector<float, 3>>("index sequence float x 3");
+    benchmark<Vector<float, 3>>("SSE float x 3");
+    benchmark<ScalarVector<double, 4>>("index sequence double x 4");
+    benchmark<Vector<double, 4>>("AVX double x 4");
+    benchmarkArrays<float, 3>("structure of arrays float x 3");
+    benchmarkArrays<double, 4>("structure of arrays double x 4");
+    benchmarkDot();
+    //                            -march=native -O0    -O3   -march=native -O3 (AVX-512, 256 bit vectors)
+    // unpadded float x 3              3419794us    99230us    60616us
+    // index sequence float x 3       24065216us   101040us    98509us
+    // SSE float x 3                   8379917us   101201us    97290us
+    // index sequence double x 4      23761721us   199719us   143907us
+    // AVX double x 4                  9445921us   185467us   140219us   (-O3 alone: no AVX, index sequence)
+    // structure of arrays float x 3   1394191us    77842us    68449us
+    // structure of arrays double x 4  2046859us   198475us   145928us
+    // dot products, unpadded          2328841us   131097us    63392us
+    // dot products, struct of arrays  1862495us    45401us    38847us
+    // The intrinsics guarantee one instruction per tuple, even without
+    // optimization. With -O3 the compiler finds that on its own, and with
+    // -march=native it vectorizes across neighbouring unpadded tuples, which
+    // beats one tuple per instruction: padding and intrinsics only pay off
+    // where the compiler does not vectorize by itself. For elementwise
+    // operations the structure of arrays is at least as fast as unpadded structs
+    // (both are streams of plain floats), for dot products it is 1.6 (native)
+    // to 2.9 (-O3, SSE only) times faster. The gcc used here picks 256 bit
+    // vectors also where 512 bit registers are available.
+}
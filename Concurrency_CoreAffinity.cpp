@@ -0,0 +1,402 @@
+/* Core-pinned executor with placement policies from the sysfs CPU topology
+ *
+ * concurrency, thread affinity, pinning, topology, SMT, cache locality, Linux
+ *
+ * motivation: PerformanceMemoryLayout1.cpp, PerformanceMemoryLayout2.cpp
+ *
+ * Threads that are not pinned may be moved to another core by the scheduler
+ * at any time, leaving their warm caches behind. A `PinnedExecutor` starts one
+ * worker per given CPU and binds it there with `pthread_setaffinity_np`.
+ * Which CPUs to use is decided by a placement policy on the `Topology`, which
+ * is read from `/sys/devices/system/cpu` (cores, SMT siblings and the CPUs
+ * sharing each cache):
+ *  - compact:    fill the SMT siblings of a core, then the next core of the
+ *                same package. Threads that share data share caches.
+ *  - scatter:    spread over packages first, then cores, SMT siblings last.
+ *                Every thread gets as much cache and memory bandwidth as possible.
+ *  - avoid SMT:  one thread per physical core, SMT siblings only if there are
+ *                more threads than cores.
+ * Cache sensitive kernels, like summing the `Small`s and `Big`s from
+ * PerformanceMemoryLayout2.cpp, profit from scatter/avoid SMT as long as their
+ * data fits into the private caches, while threads communicating a lot profit
+ * from compact placement.
+ * Linux only.
+ *
+ * compile using `g++ --std=c++20 -O3 -pthread`
+ */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <vector>
+using namespace std;
+
+//------------------------------------------------------------------------------------------Topology
+
+struct Cpu {
+    int id;
+    int core;     // `core_id` is only unique within a package
+    int package;
+    int sibling;  // index among the SMT siblings of its core
+};
+
+struct Cache {
+    int level;
+    string type;  // Data, Instruction, Unified
+    std::size_t sizeBytes;
+    vector<int> sharedBy;
+};
+
+// "0-3,8,10-11" -> {0, 1, 2, 3, 8, 10, 11}
+auto parseCpuList(string const & list) {
+    auto cpus = vector<int>{};
+    auto in = std::istringstream{list};
+    for (auto range = string{}; std::getline(in, range, ',');) {
+        if (range.empty() || range == "\n") continue;
+        auto const dash = range.find('-');
+        auto const first = std::stoi(range.substr(0, dash));
+        auto const last = dash == string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (auto cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+class Topology {
+public:
+    static auto discover(std::filesystem::path const & root = "/sys/devices/system/cpu") -> Topology;
+    static auto synthetic(int packages, int coresPerPackage, int threadsPerCore) -> Topology;
+
+    auto cpus() const -> vector<Cpu> const & { return cpus_; }
+    // empty without sysfs or cache information for `cpu`
+    auto caches(int cpu) const -> vector<Cache> const & {
+        static auto const none = vector<Cache>{};
+        auto const it = caches_.find(cpu);
+        return it != caches_.end() ? it->second : none;
+    }
+
+private:
+    void numberSiblings();
+
+    vector<Cpu> cpus_;
+    std::map<int, vector<Cache>> caches_;
+};
+
+auto readLine(std::filesystem::path const & file) -> std::optional<string> {
+    auto in = std::ifstream{file};
+    auto line = string{};
+    if (!std::getline(in, line)) return std::nullopt;
+    return line;
+}
+
+auto Topology::discover(std::filesystem::path const & root) -> Topology {
+    auto topology = Topology{};
+    auto const online = readLine(root / "online");
+    if (!online) {  // no sysfs: one package, no SMT
+        for (auto cpu = 0; cpu < (int)std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+            topology.cpus_.push_back({cpu, cpu, 0, 0});
+        return topology;
+    }
+    for (auto id : parseCpuList(*online)) {
+        auto const dir = root / ("cpu" + std::to_string(id));
+        auto const number = [&](char const * file) { return std::stoi(readLine(dir / "topology" / file).value_or("0")); };
+        topology.cpus_.push_back({id, number("core_id"), number("physical_package_id"), 0});
+
+        for (auto index = 0; std::filesystem::exists(dir / "cache" / ("index" + std::to_string(index))); ++index) {
+            auto const cache = dir / "cache" / ("index" + std::to_string(index));
+            auto const size = readLine(cache / "size").value_or("0K");  // e.g. "48K"
+            topology.caches_[id].push_back({std::stoi(readLine(cache / "level").value_or("0")),
+                                            readLine(cache / "type").value_or("?"),
+                                            std::stoul(size) * (size.back() == 'M' ? 1024 * 1024 : 1024),
+                                            parseCpuList(readLine(cache / "shared_cpu_list").value_or(""))});
+        }
+    }
+    topology.numberSiblings();
+    return topology;
+}
+
+auto Topology::synthetic(int packages, int coresPerPackage, int threadsPerCore) -> Topology {
+    // numbered like Linux does on x86: all first siblings, then all second siblings
+    auto topology = Topology{};
+    auto id = 0;
+    for (auto thread = 0; thread < threadsPerCore; ++thread)
+        for (auto package = 0; package < packages; ++package)
+            for (auto core = 0; core < coresPerPackage; ++core)
+                topology.cpus_.push_back({id++, core, package, 0});
+    topology.numberSiblings();
+    return topology;
+}
+
+void Topology::numberSiblings() {
+    std::ranges::sort(cpus_, {}, [](Cpu const & cpu) { return std::tuple{cpu.package, cpu.core, cpu.id}; });
+    for (auto i = std::size_t{1}; i < cpus_.size(); ++i)
+        if (cpus_[i].package == cpus_[i - 1].package && cpus_[i].core == cpus_[i - 1].core)
+            cpus_[i].sibling = cpus_[i - 1].sibling + 1;
+    std::ranges::sort(cpus_, {}, &Cpu::id);
+}
+
+//-----------------------------------------------------------------------------------------Placement
+
+enum class Placement { none, compact, scatter, avoidSmt };
+
+auto name(Placement placement) -> char const * {
+    switch (placement) {
+        case Placement::none:     return "none";
+        case Placement::compact:  return "compact";
+        case Placement::scatter:  return "scatter";
+        case Placement::avoidSmt: return "avoid SMT";
+    }
+    return "?";
+}
+
+constexpr int anyCpu = -1;
+
+// the CPUs for `numThreads` workers, CPUs are reused if there are more workers than CPUs
+auto place(Topology const & topology, std::size_t numThreads, Placement placement) -> vector<int> {
+    auto cpus = topology.cpus();
+    auto const key = [&](Cpu const & cpu) {
+        switch (placement) {
+            case Placement::compact:  return std::tuple{cpu.package, cpu.core, cpu.sibling};
+            case Placement::scatter:  return std::tuple{cpu.sibling, cpu.core, cpu.package};
+            case Placement::avoidSmt: return std::tuple{cpu.sibling, cpu.package, cpu.core};
+            case Placement::none:     break;
+        }
+        return std::tuple{0, 0, 0};
+    };
+    std::ranges::stable_sort(cpus, {}, key);
+
+    auto result = vector<int>(numThreads, anyCpu);
+    if (placement != Placement::none)
+        for (auto i = std::size_t{0}; i < numThreads; ++i) result[i] = cpus[i % cpus.size()].id;
+    return result;
+}
+
+void pin(std::thread & thread, int cpu) {
+    auto set = cpu_set_t{};
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (auto const error = pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set))
+        throw std::system_error{error, std::generic_category(), "pinning to cpu " + std::to_string(cpu)};
+}
+
+//------------------------------------------------------------------------------------PinnedExecutor
+// One queue per worker, so work submitted to a worker stays on its CPU.
+
+class PinnedExecutor {
+public:
+    explicit PinnedExecutor(vector<int> cpus);  // `anyCpu` leaves a worker unpinned
+    ~PinnedExecutor();
+
+    PinnedExecutor(PinnedExecutor const &)            = delete;
+    PinnedExecutor& operator=(PinnedExecutor const &) = delete;
+
+    template <typename F>
+    auto submit(std::size_t worker, F f) -> std::future<std::invoke_result_t<F>>;
+
+    template <typename F>
+    auto submit(F f) { return submit(next_++ % workers_.size(), std::move(f)); }
+
+    auto size() const noexcept { return workers_.size(); }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::condition_variable wakeUp;
+        std::deque<std::packaged_task<void()>> tasks;
+        bool stop = false;
+        std::thread thread;
+    };
+
+    static void loop(Worker & worker);
+    void stop();
+
+    vector<unique_ptr<Worker>> workers_;
+    std::size_t next_ = 0;
+};
+
+PinnedExecutor::PinnedExecutor(vector<int> cpus) {
+    for (auto cpu : cpus) {
+        auto & worker = *workers_.emplace_back(make_unique<Worker>());
+        worker.thread = std::thread{[&worker] { loop(worker); }};
+        try { if (cpu != anyCpu) pin(worker.thread, cpu); }
+        catch (...) {
+            stop();
+            throw;
+        }
+    }
+}
+
+PinnedExecutor::~PinnedExecutor() { stop(); }
+
+void PinnedExecutor::stop() {
+    for (auto & worker : workers_) {
+        {
+            auto lock = std::scoped_lock{worker->mutex};
+            worker->stop = true;
+        }
+        worker->wakeUp.notify_one();
+    }
+    for (auto & worker : workers_) worker->thread.join();
+    workers_.clear();
+}
+
+void PinnedExecutor::loop(Worker & worker) {
+    while (true) {
+        auto lock = std::unique_lock{worker.mutex};
+        worker.wakeUp.wait(lock, [&] { return worker.stop || !worker.tasks.empty(); });
+        if (worker.tasks.empty()) return;  // stop, after all tasks are done
+        auto task = std::move(worker.tasks.front());
+        worker.tasks.pop_front();
+        lock.unlock();
+        task();
+    }
+}
+
+template <typename F>
+auto PinnedExecutor::submit(std::size_t index, F f) -> std::future<std::invoke_result_t<F>> {
+    auto task = std::packaged_task<std::invoke_result_t<F>()>{std::move(f)};
+    auto future = task.get_future();
+    auto & worker = *workers_.at(index);
+    {
+        auto lock = std::scoped_lock{worker.mutex};
+        worker.tasks.emplace_back([task = std::move(task)]() mutable { task(); });
+    }
+    worker.wakeUp.notify_one();
+    return future;
+}
+
+//-------------------------------------------------------------------------------------------Kernels
+
+// PerformanceMemoryLayout1.cpp, with a matrix of a size that fits into L2
+constexpr std::size_t numRows = 512;
+using Matrix = vector<int>;  // numRows x numRows
+
+auto fast(Matrix const & m) {
+    auto result = 0ll;
+    for (auto row = std::size_t{0}; row < numRows; ++row)
+        for (auto col = std::size_t{0}; col < numRows; ++col)
+            result += m[row * numRows + col];
+    return result;
+}
+
+auto slow(Matrix const & m) {
+    auto result = 0ll;
+    for (auto col = std::size_t{0}; col < numRows; ++col)
+        for (auto row = std::size_t{0}; row < numRows; ++row)
+            result += m[row * numRows + col];
+    return result;
+}
+
+// PerformanceMemoryLayout2.cpp
+struct Small {
+    array<char,4> data{};
+    int score{rand()};
+};
+
+struct Big {
+    array<char,256> data{};
+    int score{rand()};
+};
+
+template <typename T>
+auto sum_scores(vector<T> const & arr) {
+    long long sum = 0;
+    for (auto const & element : arr)
+        sum += element.score;
+    return sum;
+}
+
+// Every worker allocates (first touch) and repeatedly sums its own data, so
+// the data stays hot in the caches of the worker's CPU unless it migrates.
+template <typename Data, typename Kernel>
+auto measure_us(PinnedExecutor & executor, Data const & prototype, Kernel kernel, int repetitions) {
+    using namespace std::chrono;
+    auto const start = steady_clock::now();
+    auto results = vector<std::future<long long>>{};
+    for (auto worker = std::size_t{0}; worker < executor.size(); ++worker)
+        results.push_back(executor.submit(worker, [&] {
+            auto const data = prototype;
+            auto sum = 0ll;
+            for (auto i = 0; i < repetitions; ++i) sum += kernel(data);
+            return sum;
+        }));
+    auto checksum = 0ll;
+    for (auto & result : results) checksum += result.get();
+    if (checksum == 42) cout << checksum;  // keep the computation
+    return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+//--------------------------------------------------------------------------------------------Try It
+
+void print(Topology const & topology) {
+    cout << "cpu  core  package  sibling\n";
+    for (auto const & cpu : topology.cpus())
+        cout << cpu.id << "  " << cpu.core << "  " << cpu.package << "  " << cpu.sibling << '\n';
+}
+
+void print(Topology const & topology, std::size_t numThreads) {
+    for (auto placement : {Placement::compact, Placement::scatter, Placement::avoidSmt}) {
+        cout << name(placement) << ":";
+        for (auto cpu : place(topology, numThreads, placement)) cout << ' ' << cpu;
+        cout << '\n';
+    }
+}
+
+int main() {
+    // placement on a machine with 2 packages of 4 cores with 2 hardware threads each
+    auto const server = Topology::synthetic(2, 4, 2);
+    print(server, 8);
+    // compact: 0 8 1 9 2 10 3 11
+    // scatter: 0 4 1 5 2 6 3 7
+    // avoid SMT: 0 1 2 3 4 5 6 7
+
+    auto const topology = Topology::discover();
+    print(topology);
+    for (auto const & cache : topology.caches(topology.cpus().front().id))
+        cout << "L" << cache.level << ' ' << cache.type << ' ' << cache.sizeBytes / 1024 << "K shared by "
+             << cache.sharedBy.size() << " cpu(s)\n";
+    cout << Topology::discover("/no/sysfs").caches(0).size() << " caches known without sysfs\n";  // 0
+
+    try { PinnedExecutor{{1024}}; }
+    catch (std::system_error const & e) { cout << "error: " << e.what() << '\n'; }
+
+    auto const matrix = Matrix(numRows * numRows, 1);
+    auto const smalls = vector<Small>(100'000);
+    auto const bigs   = vector<Big>(10'000);
+
+    auto const numThreads = topology.cpus().size();
+    cout << "\nplacement  fast  slow  Small  Big  (" << numThreads << " workers)\n";
+    for (auto placement : {Placement::none, Placement::compact, Placement::scatter, Placement::avoidSmt}) {
+        auto executor = PinnedExecutor{place(topology, numThreads, placement)};
+        cout << name(placement)
+             << "  " << measure_us(executor, matrix, [](auto const & m) { return fast(m); }, 200)
+             << "  " << measure_us(executor, matrix, [](auto const & m) { return slow(m); }, 200)
+             << "  " << measure_us(executor, smalls, [](auto const & v) { return sum_scores(v); }, 2000)
+             << "  " << measure_us(executor, bigs,   [](auto const & v) { return sum_scores(v); }, 2000) << '\n';
+    }
+    // -O3, on a VM with a single core, so all placements are the same and the
+    // differences are noise. Run it on a multi-core machine to see the effect:
+    // placement  fast  slow  Small  Big  (1 workers)
+    // none  13761  12183  65940  76403
+    // compact  22446  21959  71617  72382
+    // scatter  13562  12516  54010  69508
+    // avoid SMT  19058  19152  51672  67965
+}
@@ -0,0 +1,409 @@
+/* A coroutine task<T> type and a multi-threaded scheduler to resume tasks on
+ *
+ * concurrency, coroutines, C++20, task, scheduler, symmetric transfer
+ *
+ * motivation: Concurrency_ReturnDataAndExceptions.cpp
+ *
+ * In Concurrency_ReturnDataAndExceptions.cpp the caller blocks on `f.get()`
+ * until the other thread has computed the result. A coroutine suspends instead
+ * and frees the thread for other work. Thousands of operations can be in
+ * flight at the same time without one thread per operation.
+ * `task<T>` is lazy: its body starts running when it is `co_await`ed. When it
+ * finishes, it resumes its awaiter. Both of these steps return the coroutine
+ * to resume from `await_suspend` (symmetric transfer) instead of calling
+ * `resume()`, so the stack does not grow when tasks complete synchronously
+ * (see `sum_synchronously`, which would overflow the stack otherwise). Note
+ * that this relies on the compiler turning the transfer into a tail call,
+ * which g++ only does from -O2 on (or with -Os), and not with
+ * -fsanitize=address: at -O0, -O1 or -Og `main` overflows the stack in
+ * `sum_synchronously`, so this file requires -O2 or higher.
+ * An exception that escapes the body of a task is stored in its promise and
+ * rethrown at the `co_await` of the awaiter, just like `f.get()` rethrows the
+ * exception of a std::future.
+ * `co_await scheduler.schedule()` continues the current coroutine on one of
+ * the scheduler's worker threads. `when_all` starts many tasks at once and
+ * resumes the awaiter when the last one has finished. `sync_wait` connects
+ * the coroutine world with ordinary, blocking code in `main`.
+ *
+ * compile using `g++ --std=c++20 -O3 -pthread` (at least -O2, see above)
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = std::chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+//----------------------------------------------------------------------------------------------task
+
+template <typename T = void> class task;
+
+struct TaskPromiseBase {
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        template <typename Promise>
+        auto await_suspend(std::coroutine_handle<Promise> finished) noexcept -> std::coroutine_handle<> {
+            auto const continuation = finished.promise().continuation_;
+            return continuation ? continuation : std::noop_coroutine();  // symmetric transfer
+        }
+        void await_resume() const noexcept {}
+    };
+
+    auto initial_suspend() const noexcept { return std::suspend_always{}; }  // lazy
+    auto final_suspend()   const noexcept { return FinalAwaiter{}; }
+    void unhandled_exception() noexcept { exception_ = std::current_exception(); }
+
+    std::coroutine_handle<> continuation_;
+    std::exception_ptr exception_;
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    auto get_return_object() noexcept -> task<T>;
+
+    template <typename U>
+    void return_value(U&& value) { value_.emplace(std::forward<U>(value)); }
+
+    auto result() -> T {
+        if (exception_) std::rethrow_exception(exception_);
+        return std::move(*value_);
+    }
+
+    std::optional<T> value_;
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    auto get_return_object() noexcept -> task<void>;
+
+    void return_void() const noexcept {}
+
+    void result() const {
+        if (exception_) std::rethrow_exception(exception_);
+    }
+};
+
+template <typename T>
+class [[nodiscard]] task {
+public:
+    using promise_type = TaskPromise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit task(Handle coroutine) noexcept : coroutine_{coroutine} {}
+    task(task && other) noexcept : coroutine_{std::exchange(other.coroutine_, {})} {}
+    task& operator=(task && other) noexcept { std::swap(coroutine_, other.coroutine_); return *this; }
+    ~task() { if (coroutine_) coroutine_.destroy(); }
+
+    auto operator co_await() & noexcept { return Awaiter{coroutine_}; }
+    auto operator co_await() && noexcept { return Awaiter{coroutine_}; }
+
+private:
+    struct Awaiter {
+        bool await_ready() const noexcept { return !coroutine || coroutine.done(); }
+        auto await_suspend(std::coroutine_handle<> awaiting) noexcept -> std::coroutine_handle<> {
+            coroutine.promise().continuation_ = awaiting;
+            return coroutine;  // symmetric transfer, start the task
+        }
+        auto await_resume() -> T { return coroutine.promise().result(); }  // rethrows
+
+        Handle coroutine;
+    };
+
+    Handle coroutine_;
+};
+
+template <typename T>
+auto TaskPromise<T>::get_return_object() noexcept -> task<T> {
+    return task<T>{std::coroutine_handle<TaskPromise>::from_promise(*this)};
+}
+
+inline auto TaskPromise<void>::get_return_object() noexcept -> task<void> {
+    return task<void>{std::coroutine_handle<TaskPromise>::from_promise(*this)};
+}
+
+//-----------------------------------------------------------------------------------------Scheduler
+
+class Scheduler {
+public:
+    explicit Scheduler(unsigned numWorkers = std::max(1u, std::thread::hardware_concurrency())) {
+        for (auto i = 0u; i < numWorkers; ++i)
+            workers_.emplace_back([this] { workerLoop(); });
+    }
+
+    ~Scheduler() {
+        {
+            auto lock = std::scoped_lock{mutex_};
+            stop_ = true;
+        }
+        wakeUp_.notify_all();
+        for (auto & worker : workers_) worker.join();
+    }
+
+    Scheduler(Scheduler const &)            = delete;
+    Scheduler& operator=(Scheduler const &) = delete;
+
+    // `co_await scheduler.schedule()` continues on one of the workers
+    auto schedule() noexcept {
+        struct Awaiter {
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> coroutine) { scheduler.enqueue(coroutine); }
+            void await_resume() const noexcept {}
+            Scheduler & scheduler;
+        };
+        return Awaiter{*this};
+    }
+
+    auto size() const noexcept { return workers_.size(); }
+
+private:
+    void enqueue(std::coroutine_handle<> coroutine) {
+        {
+            auto lock = std::scoped_lock{mutex_};
+            ready_.push_back(coroutine);
+        }
+        wakeUp_.notify_one();
+    }
+
+    void workerLoop() {
+        while (true) {
+            auto lock = std::unique_lock{mutex_};
+            wakeUp_.wait(lock, [this] { return stop_ || !ready_.empty(); });
+            if (ready_.empty()) return;  // stop_
+            auto const coroutine = ready_.front();
+            ready_.pop_front();
+            lock.unlock();
+            coroutine.resume();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wakeUp_;
+    std::deque<std::coroutine_handle<>> ready_;
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
+};
+
+//-----------------------------------------------------------------------------sync_wait and when_all
+
+// Eagerly started coroutine that nobody awaits, used to drive tasks.
+struct Detached {
+    struct promise_type {
+        auto get_return_object() const noexcept { return Detached{}; }
+        auto initial_suspend()   const noexcept { return std::suspend_never{}; }
+        auto final_suspend()     const noexcept { return std::suspend_never{}; }
+        void return_void()       const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+template <typename T>
+struct SyncWaitState {
+    std::optional<std::conditional_t<std::is_void_v<T>, std::monostate, T>> value;
+    std::exception_ptr exception;
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+};
+
+template <typename T>
+auto runAndSignal(task<T> & t, SyncWaitState<T> & state) -> Detached {
+    try {
+        if constexpr (std::is_void_v<T>) co_await t;
+        else state.value.emplace(co_await t);
+    }
+    catch (...) { state.exception = std::current_exception(); }
+    auto lock = std::scoped_lock{state.mutex};  // notify under the lock, `state` dies once
+    state.done = true;                          // the waiting thread gets hold of it
+    state.finished.notify_one();
+}
+
+// blocks the calling thread until `t` is finished, returns its result or rethrows
+template <typename T>
+auto sync_wait(task<T> t) -> T {
+    auto state = SyncWaitState<T>{};
+    runAndSignal(t, state);
+    {
+        auto lock = std::unique_lock{state.mutex};
+        state.finished.wait(lock, [&] { return state.done; });
+    }
+    if (state.exception) std::rethrow_exception(state.exception);
+    if constexpr (!std::is_void_v<T>) return std::move(*state.value);
+}
+
+// starts all tasks at once, resumes the awaiter when all of them are done
+template <typename T>
+auto when_all(std::vector<task<T>> tasks) -> task<std::vector<T>> {
+    struct Shared {
+        std::vector<std::optional<T>> results;
+        std::exception_ptr exception;
+        std::atomic_flag failed;
+        std::atomic<std::size_t> remaining;
+        std::coroutine_handle<> awaiting;
+
+        void finishOne() {
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) awaiting.resume();
+        }
+    };
+
+    struct Awaiter {
+        bool await_ready() const noexcept { return tasks.empty(); }
+        auto await_suspend(std::coroutine_handle<> awaiting) -> bool {
+            shared.awaiting = awaiting;
+            shared.remaining = tasks.size() + 1;  // + 1: don't resume before all tasks are started
+            for (auto i = 0u; i < tasks.size(); ++i) runChild(tasks[i], shared, i);
+            return shared.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;  // false: all done already
+        }
+        void await_resume() const noexcept {}
+
+        static auto runChild(task<T> & t, Shared & shared, std::size_t i) -> Detached {
+            try { shared.results[i].emplace(co_await t); }
+            catch (...) { if (!shared.failed.test_and_set()) shared.exception = std::current_exception(); }
+            shared.finishOne();
+        }
+
+        std::vector<task<T>> & tasks;
+        Shared & shared;
+    };
+
+    auto shared = Shared{};
+    shared.results.resize(tasks.size());
+    co_await Awaiter{tasks, shared};
+
+    if (shared.exception) std::rethrow_exception(shared.exception);
+    auto results = std::vector<T>{};
+    results.reserve(tasks.size());
+    for (auto & result : shared.results) results.push_back(std::move(*result));
+    co_return results;
+}
+
+//-------------------------------------------------------------------------------------------Example
+// as in Concurrency_ReturnDataAndExceptions.cpp, but as coroutine
+
+auto divide_2(Scheduler & scheduler, int a, int b) -> task<int> {
+    co_await scheduler.schedule();  // continue on a worker thread
+    if (b == 0)
+        throw std::runtime_error{"dived by 0"};
+    co_return a / b;
+}
+
+auto divide_and_report(Scheduler & scheduler, int a, int b) -> task<> {
+    try {
+        const auto result = co_await divide_2(scheduler, a, b);  // suspending, not blocking
+        std::cout << "coroutine result: " << result << '\n';
+    }
+    catch (std::exception const & e) {
+        std::cout << "exception: " << e.what() << '\n';
+    }
+}
+
+auto identity(int i) -> task<int> { co_return i; }
+
+// without symmetric transfer each synchronously completing `identity` would
+// add stack frames
+auto sum_synchronously(int n) -> task<long long> {
+    auto sum = 0ll;
+    for (auto i = 0; i < n; ++i) sum += co_await identity(i);
+    co_return sum;
+}
+
+auto hop(Scheduler & scheduler, int numHops) -> task<int> {
+    for (auto i = 0; i < numHops; ++i) co_await scheduler.schedule();
+    co_return numHops;
+}
+
+auto many_divisions(Scheduler & scheduler, int n) -> task<long long> {
+    auto tasks = std::vector<task<int>>{};
+    for (auto i = 0; i < n; ++i) tasks.push_back(divide_2(scheduler, i, 1));
+    auto sum = 0ll;
+    for (auto const result : co_await when_all(std::move(tasks))) sum += result;
+    co_return sum;
+}
+
+auto one() { return 1; }
+
+//--------------------------------------------------------------------------------------------Try It
+
+int main() {
+    auto scheduler = Scheduler{};
+    std::cout << "workers: " << scheduler.size() << '\n';
+
+    sync_wait(divide_and_report(scheduler, 45, 5));  // 9
+    sync_wait(divide_and_report(scheduler, 45, 0));  // dived by 0
+
+    try {  // exceptions also travel through when_all and sync_wait
+        auto tasks = std::vector<task<int>>{};
+        tasks.push_back(divide_2(scheduler, 45, 5));
+        tasks.push_back(divide_2(scheduler, 45, 0));
+        sync_wait(when_all(std::move(tasks)));
+    }
+    catch (std::exception const & e) {
+        std::cout << "when_all exception: " << e.what() << '\n';
+    }
+
+    std::cout << "sum: " << sync_wait(sum_synchronously(10'000'000)) << '\n';  // 49999995000000
+
+    // 10000 operations in flight at the same time, on a handful of threads
+    {
+        ScopedTimer t{"10000 concurrent tasks"};  // -O3: 8139us
+        std::cout << sync_wait(many_divisions(scheduler, 10'000)) << '\n';
+    }
+
+    // cost of a context switch: continue on another thread, wait for a result
+    constexpr auto numSwitches = 10'000;
+    {
+        ScopedTimer t{"10000 coroutine hops"};          // -O3:    570us
+        sync_wait(hop(scheduler, numSwitches));
+    }
+    {
+        ScopedTimer t{"10000 std::async round trips"};  // -O3: 166996us
+        for (auto i = 0; i < numSwitches; ++i) std::async(std::launch::async, one).get();
+    }
+    {
+        ScopedTimer t{"10000 std::thread round trips"}; // -O3: 166780us
+        for (auto i = 0; i < numSwitches; ++i) {
+            auto task = std::packaged_task<int()>{one};
+            auto f = task.get_future();
+            std::thread(std::move(task)).join();
+            f.get();
+        }
+    }
+}
@@ -0,0 +1,509 @@
+/* A lightweight future/promise pair with continuations, when_all and when_any
+ *
+ * concurrency, future, promise, continuation, atomics, futex, memory pool
+ *
+ * motivation: Concurrency_ReturnDataAndExceptions.cpp
+ *
+ * std::promise/std::future (and std::packaged_task, std::async, which build
+ * on them) allocate their shared state on the free store and synchronize via
+ * a mutex and a condition variable. Our `Future`/`Promise` differ in three
+ * aspects:
+ * 1. The shared state comes from a thread local free list (`ObjectPool`).
+ *    After warming up, creating a promise does not touch the free store, as
+ *    long as states are released on the thread that allocates them. (States
+ *    that keep travelling from one thread to another, which is possible, but
+ *    not the common case for our futures, fill up the free list of one thread
+ *    and drain the one of the other. Once a free list is full, states go back
+ *    to the free store.)
+ * 2. All synchronization happens through one atomic word of flags (value set,
+ *    exception set, continuation set). A waiting `get()` sleeps in
+ *    `std::atomic::wait`, which libstdc++ implements with a futex on Linux.
+ * 3. `then(f)` attaches a continuation that runs as soon as the value is
+ *    there, either on the thread that sets the value or immediately, if the
+ *    value was already set. The continuation is stored in a small buffer
+ *    inside the shared state, attaching it does not allocate either.
+ *    `when_all` and `when_any` combine futures based on continuations.
+ * Exceptions behave as with std::future: `get()` rethrows what the task threw,
+ * continuations are skipped and the exception arrives at the end of the chain.
+ * A promise that is destroyed without a result breaks its future with
+ * std::future_error, again as with std::promise.
+ *
+ * compile using `g++ --std=c++20 -O3 -pthread`
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = std::chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+// count allocations on the free store, see SmallStringOptimization.cpp
+auto allocations = std::atomic<std::size_t>{0};
+
+void* operator new(std::size_t size) {
+    ++allocations;
+    if (void* p = std::malloc(size)) return p;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+    return std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    return std::free(p);
+}
+
+//----------------------------------------------------------------------------------------ObjectPool
+// Thread local free list of memory blocks large enough to hold a `T`.
+
+template <typename T>
+class ObjectPool {
+public:
+    static auto allocate() -> void* {
+        auto & list = freeList();
+        if (auto* node = list.head) {
+            list.head = node->next;
+            --list.size;
+            return node;
+        }
+        return ::operator new(sizeof(T));
+    }
+
+    static void deallocate(void* p) noexcept {
+        auto & list = freeList();
+        if (list.size == maxCached) return ::operator delete(p);
+        list.head = ::new (p) Node{list.head};
+        ++list.size;
+    }
+
+private:
+    struct Node { Node* next; };
+    static_assert(sizeof(T) >= sizeof(Node));
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+    struct FreeList {
+        ~FreeList() {
+            while (head) ::operator delete(std::exchange(head, head->next));
+        }
+        Node* head = nullptr;
+        std::size_t size = 0;
+    };
+
+    static auto freeList() -> FreeList & {
+        thread_local FreeList list;
+        return list;
+    }
+
+    static constexpr std::size_t maxCached = 1024;
+};
+
+//---------------------------------------------------------------------------------------SharedState
+
+template <typename T>
+class SharedState {
+public:
+    static auto create() -> SharedState* { return ::new (ObjectPool<SharedState>::allocate()) SharedState{}; }
+
+    void addRef() noexcept { refs_.fetch_add(1, std::memory_order_relaxed); }
+    void release() noexcept {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            this->~SharedState();
+            ObjectPool<SharedState>::deallocate(this);
+        }
+    }
+
+    auto isReady() const noexcept -> bool { return state_.load(std::memory_order_acquire) & ready; }
+
+    template <typename... Args>
+    void setValue(Args&&... args) {
+        throwIfReady();
+        ::new (static_cast<void*>(value_)) T(std::forward<Args>(args)...);
+        publish(hasValue);
+    }
+
+    void setException(std::exception_ptr exception) {
+        throwIfReady();
+        exception_ = std::move(exception);
+        publish(hasException);
+    }
+
+    void wait() const noexcept {
+        auto state = state_.load(std::memory_order_acquire);
+        while (!(state & ready)) {
+            state_.wait(state, std::memory_order_acquire);
+            state = state_.load(std::memory_order_acquire);
+        }
+    }
+
+    auto take() -> T {
+        wait();
+        if (exception_) std::rethrow_exception(exception_);
+        return std::move(value());
+    }
+
+    // `continuation(state)` runs exactly once, as soon as the state is ready.
+    // It takes over the reference to the state held by the future.
+    template <typename Continuation>
+    void setContinuation(Continuation&& continuation);
+
+private:
+    enum : std::uint32_t { hasValue = 1, hasException = 2, hasContinuation = 4, ready = hasValue | hasException };
+    static constexpr std::size_t continuationSize = 64;
+
+    SharedState() = default;
+    ~SharedState() { if (state_.load(std::memory_order_relaxed) & hasValue) value().~T(); }
+
+    auto value() noexcept -> T & { return *std::launder(reinterpret_cast<T*>(value_)); }
+
+    void throwIfReady() const {
+        if (isReady()) throw std::future_error{std::future_errc::promise_already_satisfied};
+    }
+
+    void publish(std::uint32_t flag) {
+        auto const old = state_.fetch_or(flag, std::memory_order_acq_rel);
+        if (old & hasContinuation) runContinuation_(continuation_, this);
+        else state_.notify_all();
+    }
+
+    std::atomic<std::uint32_t> state_{0};
+    std::atomic<std::uint32_t> refs_{1};
+    alignas(T) std::byte value_[sizeof(T)];
+    std::exception_ptr exception_;
+    void (*runContinuation_)(void* continuation, SharedState* state) = nullptr;
+    alignas(std::max_align_t) std::byte continuation_[continuationSize];
+};
+
+template <typename T>
+template <typename Continuation>
+void SharedState<T>::setContinuation(Continuation&& continuation) {
+    using C = std::decay_t<Continuation>;
+    static_assert(sizeof(C) <= continuationSize, "continuation too large for the inline buffer");
+    static_assert(alignof(C) <= alignof(std::max_align_t));
+
+    ::new (static_cast<void*>(continuation_)) C(std::forward<Continuation>(continuation));
+    runContinuation_ = [](void* buffer, SharedState* state) {
+        // move to the stack first: running it may release the state and with it the buffer
+        auto* stored = static_cast<C*>(buffer);
+        auto local = C(std::move(*stored));
+        stored->~C();
+        local(state);
+    };
+    auto const old = state_.fetch_or(hasContinuation, std::memory_order_acq_rel);
+    if (old & ready) runContinuation_(continuation_, this);
+}
+
+//------------------------------------------------------------------------------------Future/Promise
+
+template <typename T> class Future;
+
+template <typename T>
+class Promise {
+public:
+    Promise() : state_{SharedState<T>::create()} {}
+    Promise(Promise && other) noexcept : state_{std::exchange(other.state_, nullptr)} {}
+    Promise& operator=(Promise && other) noexcept { std::swap(state_, other.state_); return *this; }
+    ~Promise() {
+        if (!state_) return;
+        if (!state_->isReady())
+            state_->setException(std::make_exception_ptr(std::future_error{std::future_errc::broken_promise}));
+        state_->release();
+    }
+
+    auto get_future() -> Future<T> {
+        state_->addRef();
+        return Future<T>{state_};
+    }
+
+    template <typename... Args>
+    void set_value(Args&&... args) { state_->setValue(std::forward<Args>(args)...); }
+    void set_exception(std::exception_ptr exception) { state_->setException(std::move(exception)); }
+
+private:
+    SharedState<T>* state_;
+};
+
+template <typename T>
+class Future {
+public:
+    Future() = default;
+    explicit Future(SharedState<T>* state) noexcept : state_{state} {}
+    Future(Future && other) noexcept : state_{std::exchange(other.state_, nullptr)} {}
+    Future& operator=(Future && other) noexcept { std::swap(state_, other.state_); return *this; }
+    ~Future() { if (state_) state_->release(); }
+
+    auto valid()    const noexcept { return state_ != nullptr; }
+    auto is_ready() const noexcept { return state_->isReady(); }
+    void wait()     const noexcept { state_->wait(); }
+
+    // blocks until ready, returns the value or rethrows the exception, invalidates the future
+    auto get() -> T {
+        struct Release {
+            ~Release() { state->release(); }
+            SharedState<T>* state;
+        } release{std::exchange(state_, nullptr)};
+        return release.state->take();
+    }
+
+    // `f(future)` runs once the future is ready, receives the ready future
+    template <typename F>
+    void on_ready(F&& f) {
+        std::exchange(state_, nullptr)->setContinuation(
+            [f = std::forward<F>(f)](SharedState<T>* state) mutable { f(Future{state}); });
+    }
+
+    // `f(value)` runs once the value is there. If the future holds an exception
+    // instead, `f` is skipped and the exception is passed on.
+    template <typename F>
+    auto then(F&& f) -> Future<std::invoke_result_t<F, T>>;
+
+private:
+    SharedState<T>* state_ = nullptr;
+};
+
+template <typename T>
+template <typename F>
+auto Future<T>::then(F&& f) -> Future<std::invoke_result_t<F, T>> {
+    using U = std::invoke_result_t<F, T>;
+    static_assert(!std::is_void_v<U>, "continuations have to return a value");
+    auto promise = Promise<U>{};
+    auto future = promise.get_future();
+    on_ready([f = std::forward<F>(f), promise = std::move(promise)](Future<T> ready) mutable {
+        try { promise.set_value(std::invoke(f, ready.get())); }
+        catch (...) { promise.set_exception(std::current_exception()); }
+    });
+    return future;
+}
+
+//-----------------------------------------------------------------------------------------Combinators
+
+// ready when all futures are ready, holds all values or the first exception
+template <typename... Ts>
+auto when_all(Future<Ts>&&... futures) -> Future<std::tuple<Ts...>> {
+    struct Aggregate {
+        std::tuple<std::optional<Ts>...> values;
+        std::exception_ptr exception;
+        std::atomic_flag failed;
+        std::atomic<std::size_t> remaining{sizeof...(Ts)};
+        Promise<std::tuple<Ts...>> promise;
+
+        void finish() {
+            if (exception) promise.set_exception(exception);
+            else promise.set_value(std::apply([](auto&... v) { return std::tuple{std::move(*v)...}; }, values));
+            this->~Aggregate();
+            ObjectPool<Aggregate>::deallocate(this);
+        }
+    };
+    auto* aggregate = ::new (ObjectPool<Aggregate>::allocate()) Aggregate{};
+    auto result = aggregate->promise.get_future();
+
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+        (futures.on_ready([aggregate](auto ready) {
+            try { std::get<I>(aggregate->values).emplace(ready.get()); }
+            catch (...) { if (!aggregate->failed.test_and_set()) aggregate->exception = std::current_exception(); }
+            if (aggregate->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) aggregate->finish();
+        }), ...);
+    }(std::index_sequence_for<Ts...>{});
+    return result;
+}
+
+// ready as soon as the first future is ready, holds its value or exception
+template <typename T, std::same_as<T>... Ts>
+auto when_any(Future<T>&& first, Future<Ts>&&... rest) -> Future<T> {
+    struct Aggregate {
+        std::atomic_flag done;
+        std::atomic<std::size_t> remaining{1 + sizeof...(Ts)};
+        Promise<T> promise;
+    };
+    auto* aggregate = ::new (ObjectPool<Aggregate>::allocate()) Aggregate{};
+    auto result = aggregate->promise.get_future();
+
+    auto const onReady = [aggregate](Future<T> ready) {
+        if (!aggregate->done.test_and_set()) {
+            try { aggregate->promise.set_value(ready.get()); }
+            catch (...) { aggregate->promise.set_exception(std::current_exception()); }
+        }
+        if (aggregate->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            aggregate->~Aggregate();
+            ObjectPool<Aggregate>::deallocate(aggregate);
+        }
+    };
+    first.on_ready(onReady);
+    (rest.on_ready(onReady), ...);
+    return result;
+}
+
+// run `f(args...)` on a new thread, the counterpart of std::async for `Future`
+template <typename F, typename... Args>
+auto launch(F&& f, Args&&... args) -> Future<std::invoke_result_t<F, Args...>> {
+    auto promise = Promise<std::invoke_result_t<F, Args...>>{};
+    auto future = promise.get_future();
+    std::thread([promise = std::move(promise), f = std::forward<F>(f), ...args = std::forward<Args>(args)]() mutable {
+        try { promise.set_value(std::invoke(std::move(f), std::move(args)...)); }
+        catch (...) { promise.set_exception(std::current_exception()); }
+    }).detach();
+    return future;
+}
+
+//-------------------------------------------------------------------------------------------Example
+// as in Concurrency_ReturnDataAndExceptions.cpp
+
+auto divide_1(int a, int b, Promise<int> & p) {
+    if (b == 0) p.set_exception(std::make_exception_ptr(std::runtime_error{"divide by 0"}));
+    else        p.set_value(a / b);
+}
+
+auto divide_2(int a, int b) {
+    if (b == 0)
+        throw std::runtime_error{"dived by 0"};
+    return a / b;
+}
+
+template <typename F>
+void print(char const * label, F&& get) {
+    try {
+        auto const result = get();  // blocking
+        std::cout << label << " result: " << result << '\n';
+    }
+    catch (std::exception const & e) {
+        std::cout << label << " exception: " << e.what() << '\n';
+    }
+}
+
+//--------------------------------------------------------------------------------------------Try It
+
+int main() {
+    // explicit promise, as in alternative 1
+    for (auto const divisor : {5, 0}) {
+        auto p = Promise<int>{};
+        auto f = p.get_future();
+        std::thread(divide_1, 45, divisor, std::ref(p)).join();
+        print("promise", [&] { return f.get(); });
+    }
+
+    // launched task, as in alternatives 2 and 3
+    print("launch", [] { return launch(divide_2, 45, 5).get(); });  // 9
+    print("launch", [] { return launch(divide_2, 45, 0).get(); });  // dived by 0
+
+    // continuations, an exception skips the continuations
+    print("then", [] { return launch(divide_2, 45, 5).then([](int r) { return r * 2; }).get(); });  // 18
+    print("then", [] { return launch(divide_2, 45, 0).then([](int r) { return r * 2; }).get(); });  // dived by 0
+
+    // combinators
+    print("when_all", [] {
+        auto [a, b] = when_all(launch(divide_2, 45, 5), launch(divide_2, 10, 2)).get();
+        return a + b; });  // 14
+    print("when_all", [] {
+        auto [a, b] = when_all(launch(divide_2, 45, 5), launch(divide_2, 10, 0)).get();
+        return a + b; });  // dived by 0
+    print("when_any", [] { return when_any(launch(divide_2, 45, 5), launch(divide_2, 45, 5)).get(); });  // 9
+
+    // no task gets its result from a promise that was never fulfilled
+    print("broken", [] {
+        auto f = Promise<int>{}.get_future();
+        return f.get(); });  // broken promise
+
+    // create, fulfil and retrieve many pairs on one thread
+    constexpr auto numRoundTrips = 1'000'000;
+    auto checksum = 0ll;
+    auto allocationsBefore = allocations.load();
+    {
+        ScopedTimer t{"std::promise"};    // 1855328us, -O3: 363908us
+        for (auto i = 0; i < numRoundTrips; ++i) {
+            auto p = std::promise<int>{};
+            auto f = p.get_future();
+            p.set_value(i);
+            checksum += f.get();
+        }
+    }
+    std::cout << "allocations: " << allocations - allocationsBefore << '\n';  // 2000000
+    allocationsBefore = allocations.load();
+    {
+        ScopedTimer t{"Promise"};         //  228893us, -O3:  56990us
+        for (auto i = 0; i < numRoundTrips; ++i) {
+            auto p = Promise<int>{};
+            auto f = p.get_future();
+            p.set_value(i);
+            checksum += f.get();
+        }
+    }
+    std::cout << "allocations: " << allocations - allocationsBefore << '\n';  // 0
+    allocationsBefore = allocations.load();
+    {
+        ScopedTimer t{"Promise + then"};  //  694340us, -O3: 133250us
+        for (auto i = 0; i < numRoundTrips; ++i) {
+            auto p = Promise<int>{};
+            auto f = p.get_future().then([](int v) { return v + 1; });
+            p.set_value(i);
+            checksum += f.get();
+        }
+    }
+    std::cout << "allocations: " << allocations - allocationsBefore << '\n';  // 1 (the pool held a single state, `then` needs a second one)
+
+    // ping-pong between two threads, each round trip waits for the other thread
+    constexpr auto numPingPongs = 10'000;
+    {
+        ScopedTimer t{"ping-pong std::promise"};  // 93327us, -O3: 52003us
+        auto requests = std::vector<std::promise<int>>(numPingPongs);
+        auto replies  = std::vector<std::promise<int>>(numPingPongs);
+        auto echo = std::thread([&] {
+            for (auto i = 0; i < numPingPongs; ++i) replies[i].set_value(requests[i].get_future().get()); });
+        for (auto i = 0; i < numPingPongs; ++i) {
+            requests[i].set_value(i);
+            checksum += replies[i].get_future().get();
+        }
+        echo.join();
+    }
+    {
+        ScopedTimer t{"ping-pong Promise"};       // 71086us, -O3: 43151us
+        auto requests = std::vector<Promise<int>>(numPingPongs);
+        auto replies  = std::vector<Promise<int>>(numPingPongs);
+        auto echo = std::thread([&] {
+            for (auto i = 0; i < numPingPongs; ++i) replies[i].set_value(requests[i].get_future().get()); });
+        for (auto i = 0; i < numPingPongs; ++i) {
+            requests[i].set_value(i);
+            checksum += replies[i].get_future().get();
+        }
+        echo.join();
+    }
+    std::cout << checksum << '\n';
+}
@@ -0,0 +1,344 @@
+/* Bounded lock-free queues: wait-free SPSC and sequence-number based MPMC
+ *
+ * concurrency, lock-free, atomics, ring buffer, queue, producer-consumer, false sharing
+ *
+ * motivation: C++ High Performance
+ *
+ * In Concurrency_ReturnDataAndExceptions.cpp every task hands over exactly one
+ * value through a promise. To pass a stream of values from one thread to
+ * another we need a queue. Both queues below are ring buffers with a capacity
+ * that is a power of two, so the index of a slot is `position & mask`.
+ * `SpscQueue` supports one producer and one consumer. The producer only
+ * writes `tail_`, the consumer only writes `head_`, no compare-and-swap is
+ * needed and every operation finishes in a bounded number of steps
+ * (wait-free). Each side keeps a cached copy of the other side's index and
+ * only reloads it when the queue looks full (empty), which saves most of the
+ * cache line transfers between the cores.
+ * `MpmcQueue` supports any number of producers and consumers (Dmitry Vyukov's
+ * bounded MPMC queue). Every slot carries a sequence number that tells
+ * whether it is ready to be written or to be read in the current lap.
+ * Producers (consumers) claim a position with a compare-and-swap on
+ * `enqueuePos_` (`dequeuePos_`).
+ * In both queues the indices written by producers and consumers live in
+ * different cache lines. Otherwise every push would invalidate the line the
+ * consumers are reading and vice versa (false sharing).
+ * `push` and `pop` block until there is space (an element). How they wait is
+ * selected by a policy: `SpinWait` spins (with `pause`) and yields, which has
+ * the lowest latency but burns a core; `BlockingWait` sleeps on a futex via
+ * `std::atomic::wait` and costs the other side a check (and maybe a wake up)
+ * per operation.
+ * The elements have to be default constructible and move assignable.
+ *
+ * compile using `g++ --std=c++20 -O3 -pthread`
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>  // _mm_pause
+#endif
+
+constexpr std::size_t cacheLineSize = 64;  // Linux: `getconf LEVEL1_DCACHE_LINESIZE`
+
+// tells the core that this is a spin loop, elsewhere at least lets the other thread run
+inline void cpuRelax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+//-------------------------------------------------------------------------------------Wait strategies
+
+struct SpinWait {
+    template <typename Predicate>
+    void wait(Predicate ready) const {
+        for (auto spins = 0; !ready(); ++spins) {
+            if (spins < 64) cpuRelax();
+            else std::this_thread::yield();
+        }
+    }
+    void notify() noexcept {}
+};
+
+class BlockingWait {
+public:
+    template <typename Predicate>
+    void wait(Predicate ready) {
+        while (!ready()) {
+            auto const epoch = epoch_.load();
+            waiters_.fetch_add(1);  // seq_cst, pairs with the load in `notify`
+            if (!ready()) epoch_.wait(epoch);
+            waiters_.fetch_sub(1);
+        }
+    }
+
+    void notify() noexcept {
+        std::atomic_thread_fence(std::memory_order_seq_cst);  // order the published element before the check
+        if (waiters_.load(std::memory_order_relaxed) > 0) {
+            epoch_.fetch_add(1);
+            epoch_.notify_all();
+        }
+    }
+
+private:
+    std::atomic<std::uint32_t> epoch_{0};
+    std::atomic<std::uint32_t> waiters_{0};
+};
+
+//------------------------------------------------------------------------------------------SpscQueue
+
+template <typename T, std::size_t Capacity, typename WaitStrategy = SpinWait>
+class SpscQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+public:
+    template <typename U>
+    auto try_push(U&& value) -> bool {
+        auto const tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cachedHead_ == Capacity) {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail - cachedHead_ == Capacity) return false;  // full
+        }
+        buffer_[tail & mask] = std::forward<U>(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        notEmpty_.notify();
+        return true;
+    }
+
+    auto try_pop() -> std::optional<T> {
+        auto const head = head_.load(std::memory_order_relaxed);
+        if (head == cachedTail_) {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head == cachedTail_) return std::nullopt;  // empty
+        }
+        auto value = std::move(buffer_[head & mask]);
+        head_.store(head + 1, std::memory_order_release);
+        notFull_.notify();
+        return value;
+    }
+
+    void push(T value) {
+        while (!try_push(std::move(value)))  // only moved from on success
+            notFull_.wait([this] { return tail_.load(std::memory_order_relaxed) - head_.load() < Capacity; });
+    }
+
+    auto pop() -> T {
+        while (true) {
+            if (auto value = try_pop()) return std::move(*value);
+            notEmpty_.wait([this] { return tail_.load() != head_.load(std::memory_order_relaxed); });
+        }
+    }
+
+private:
+    static constexpr std::size_t mask = Capacity - 1;
+
+    // consumer side
+    alignas(cacheLineSize) std::atomic<std::size_t> head_{0};
+    std::size_t cachedTail_ = 0;
+    WaitStrategy notFull_;
+    // producer side
+    alignas(cacheLineSize) std::atomic<std::size_t> tail_{0};
+    std::size_t cachedHead_ = 0;
+    WaitStrategy notEmpty_;
+
+    alignas(cacheLineSize) std::array<T, Capacity> buffer_{};
+};
+
+//------------------------------------------------------------------------------------------MpmcQueue
+
+template <typename T, std::size_t Capacity, typename WaitStrategy = SpinWait>
+class MpmcQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+public:
+    MpmcQueue() {
+        for (auto i = std::size_t{0}; i < Capacity; ++i)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    template <typename U>
+    auto try_push(U&& value) -> bool {
+        auto pos = enqueuePos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[pos & mask];
+            auto const sequence = cell->sequence.load(std::memory_order_acquire);
+            auto const diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {  // free in this lap, try to claim it
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) return false;  // still holds the element from the last lap: full
+            else pos = enqueuePos_.load(std::memory_order_relaxed);  // another producer was faster
+        }
+        cell->value = std::forward<U>(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);  // ready to be read
+        notEmpty_.notify();
+        return true;
+    }
+
+    auto try_pop() -> std::optional<T> {
+        auto pos = dequeuePos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[pos & mask];
+            auto const sequence = cell->sequence.load(std::memory_order_acquire);
+            auto const diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) return std::nullopt;  // not written yet: empty
+            else pos = dequeuePos_.load(std::memory_order_relaxed);
+        }
+        auto value = std::move(cell->value);
+        cell->sequence.store(pos + Capacity, std::memory_order_release);  // ready to be written in the next lap
+        notFull_.notify();
+        return value;
+    }
+
+    void push(T value) {
+        while (!try_push(std::move(value)))
+            notFull_.wait([this] { return enqueuePos_.load() - dequeuePos_.load() < Capacity; });
+    }
+
+    auto pop() -> T {
+        while (true) {
+            if (auto value = try_pop()) return std::move(*value);
+            notEmpty_.wait([this] { return enqueuePos_.load() != dequeuePos_.load(); });
+        }
+    }
+
+private:
+    static constexpr std::size_t mask = Capacity - 1;
+
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T value{};
+    };
+
+    alignas(cacheLineSize) std::atomic<std::size_t> enqueuePos_{0};
+    WaitStrategy notEmpty_;
+    alignas(cacheLineSize) std::atomic<std::size_t> dequeuePos_{0};
+    WaitStrategy notFull_;
+    alignas(cacheLineSize) std::array<Cell, Capacity> cells_;
+};
+
+//-----------------------------------------------------------------------------------------MutexQueue
+// for comparison: the textbook bounded queue
+
+template <typename T, std::size_t Capacity>
+class MutexQueue {
+public:
+    void push(T value) {
+        {
+            auto lock = std::unique_lock{mutex_};
+            notFull_.wait(lock, [this] { return queue_.size() < Capacity; });
+            queue_.push_back(std::move(value));
+        }
+        notEmpty_.notify_one();
+    }
+
+    auto pop() -> T {
+        auto lock = std::unique_lock{mutex_};
+        notEmpty_.wait(lock, [this] { return !queue_.empty(); });
+        auto value = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        notFull_.notify_one();
+        return value;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable notEmpty_, notFull_;
+    std::deque<T> queue_;
+};
+
+//-------------------------------------------------------------------------------------------Benchmark
+
+// `producers` threads push `numItems` values in total, `consumers` threads pop them
+template <typename Queue>
+void throughput(char const * name, int producers, int consumers, long long numItems) {
+    auto queue = std::make_unique<Queue>();
+    auto sum = std::atomic<long long>{0};
+    auto const start = std::chrono::steady_clock::now();
+    {
+        auto threads = std::vector<std::jthread>{};
+        for (auto p = 0; p < producers; ++p)
+            threads.emplace_back([&, p] {
+                for (auto i = p; i < numItems; i += producers) queue->push(i); });
+        for (auto c = 0; c < consumers; ++c)
+            threads.emplace_back([&, c] {
+                auto partial = 0ll;
+                for (auto i = c; i < numItems; i += consumers) partial += queue->pop();
+                sum += partial; });
+    }
+    auto const us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ' ' << producers << "P/" << consumers << "C: "
+              << static_cast<double>(numItems) / std::max(us, 1l) << " Mops/s"
+              << (sum == numItems * (numItems - 1) / 2 ? "" : " WRONG SUM") << '\n';
+}
+
+// one thread sends a value, the other one sends it back
+template <typename Queue>
+void latency(char const * name, int numRoundTrips) {
+    auto ping = std::make_unique<Queue>();
+    auto pong = std::make_unique<Queue>();
+    auto echo = std::jthread([&] {
+        for (auto i = 0; i < numRoundTrips; ++i) pong->push(ping->pop()); });
+    auto const start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < numRoundTrips; ++i) {
+        ping->push(i);
+        pong->pop();
+    }
+    auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << name << " latency: " << ns / numRoundTrips / 2 << "ns one way\n";
+}
+
+//--------------------------------------------------------------------------------------------Try It
+
+int main() {
+    constexpr auto capacity = std::size_t{1024};
+    constexpr auto numItems = 1'000'000ll;
+
+    throughput<SpscQueue <long long, capacity, SpinWait    >>("spsc spinning", 1, 1, numItems);
+    throughput<SpscQueue <long long, capacity, BlockingWait>>("spsc blocking", 1, 1, numItems);
+    for (auto const threads : {1, 2, 4}) {
+        throughput<MpmcQueue <long long, capacity, SpinWait    >>("mpmc spinning", threads, threads, numItems);
+        throughput<MpmcQueue <long long, capacity, BlockingWait>>("mpmc blocking", threads, threads, numItems);
+        throughput<MutexQueue<long long, capacity              >>("mutex        ", threads, threads, numItems);
+    }
+
+    constexpr auto numRoundTrips = 10'000;
+    latency<SpscQueue <long long, capacity, SpinWait    >>("spsc spinning", numRoundTrips);
+    latency<SpscQueue <long long, capacity, BlockingWait>>("spsc blocking", numRoundTrips);
+    latency<MpmcQueue <long long, capacity, SpinWait    >>("mpmc spinning", numRoundTrips);
+    latency<MpmcQueue <long long, capacity, BlockingWait>>("mpmc blocking", numRoundTrips);
+    latency<MutexQueue<long long, capacity              >>("mutex        ", numRoundTrips);
+
+    // -O3, on a VM with a single core (threads take turns, nothing runs in parallel):
+    // spsc spinning 1P/1C: 133.797 Mops/s
+    // spsc blocking 1P/1C: 1.47469 Mops/s
+    // mpmc spinning 1P/1C: 19.9629 Mops/s
+    // mpmc blocking 1P/1C: 1.17521 Mops/s
+    // mutex         1P/1C: 7.78865 Mops/s
+    // mpmc spinning 4P/4C: 19.9132 Mops/s
+    // mpmc blocking 4P/4C: 1.16962 Mops/s
+    // mutex         4P/4C: 6.48534 Mops/s
+    // spsc spinning latency: 2752ns one way
+    // spsc blocking latency: 2007ns one way
+    // mutex         latency: 2212ns one way
+}
@@ -0,0 +1,327 @@
+/* Work-stealing thread pool that returns futures
+ *
+ * concurrency, parallel, task, thread pool, work stealing, packaged_task, future
+ *
+ * motivation: Concurrency_ReturnDataAndExceptions.cpp
+ *
+ * In Concurrency_ReturnDataAndExceptions.cpp every task gets a thread of its
+ * own, either explicitly or hidden behind std::async. Creating and joining a
+ * thread is expensive compared to a small task. A thread pool creates a fixed
+ * number of workers once and feeds them tasks.
+ * Every worker owns a deque of tasks. A worker pushes and pops tasks at the
+ * back of its own deque (LIFO, the most recent task is the most likely one to
+ * be hot in the cache). A worker that runs out of tasks steals from the front
+ * of another worker's deque (FIFO, the oldest task tends to be the biggest
+ * chunk of remaining work). Each deque is protected by its own mutex, so
+ * workers only contend when stealing. Idle workers sleep on a condition
+ * variable instead of spinning.
+ * `submit(f, args...)` wraps the call in a std::packaged_task, so exceptions
+ * reach the caller through the future exactly like in alternative 2.
+ * Tasks may submit tasks themselves. They end up in the submitting worker's
+ * deque. A task that needs the result of a nested task must not block its
+ * worker on `future::get()` (with every worker blocked like this, nobody is
+ * left to run the nested tasks). `ThreadPool::get` runs other tasks while
+ * waiting instead.
+ *
+ * compile using `g++ --std=c++20 -O3 -pthread`
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = std::chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+//----------------------------------------------------------------------------------------------Task
+// Move-only `void()` callable. std::function requires copyable targets, but
+// std::packaged_task can only be moved.
+
+class Task {
+public:
+    Task() = default;
+    template <typename F>
+    explicit Task(F&& f) : callable_{std::make_unique<Model<std::decay_t<F>>>(std::forward<F>(f))} {}
+
+    void operator()() { callable_->call(); }
+
+private:
+    struct Concept {
+        virtual ~Concept() = default;
+        virtual void call() = 0;
+    };
+
+    template <typename F>
+    struct Model : Concept {
+        explicit Model(F&& f) : f_{std::move(f)} {}
+        void call() override { f_(); }
+    private:
+        F f_;
+    };
+
+    std::unique_ptr<Concept> callable_;
+};
+
+//----------------------------------------------------------------------------------------ThreadPool
+
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned numWorkers = std::max(1u, std::thread::hardware_concurrency()));
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const &)            = delete;
+    ThreadPool& operator=(ThreadPool const &) = delete;
+
+    template <typename F, typename... Args>
+    auto submit(F&& f, Args&&... args) -> std::future<std::invoke_result_t<F, Args...>>;
+
+    // Like `future.get()`, but runs pending tasks while the result is not
+    // ready. Use this to wait for nested tasks from within a worker.
+    template <typename T>
+    auto get(std::future<T> & future) -> T;
+
+    auto size() const noexcept { return workers_.size(); }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void push(Task task);
+    auto tryPop(std::size_t self) -> std::optional<Task>;
+    void workerLoop(std::size_t self);
+
+    static thread_local ThreadPool* currentPool_;
+    static thread_local std::size_t currentWorker_;
+
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<std::size_t> nextQueue_{0};  // round robin for tasks submitted from outside
+
+    std::mutex sleepMutex_;
+    std::condition_variable wakeUp_;
+    std::atomic<std::size_t> pending_{0};
+    bool stop_ = false;
+};
+
+thread_local ThreadPool* ThreadPool::currentPool_ = nullptr;
+thread_local std::size_t ThreadPool::currentWorker_ = 0;
+
+ThreadPool::ThreadPool(unsigned numWorkers) {
+    for (auto i = 0u; i < numWorkers; ++i)
+        queues_.push_back(std::make_unique<WorkQueue>());
+    for (auto i = 0u; i < numWorkers; ++i)
+        workers_.emplace_back([this, i] { workerLoop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        auto lock = std::scoped_lock{sleepMutex_};
+        stop_ = true;
+    }
+    wakeUp_.notify_all();
+    for (auto & worker : workers_) worker.join();
+}
+
+template <typename F, typename... Args>
+auto ThreadPool::submit(F&& f, Args&&... args) -> std::future<std::invoke_result_t<F, Args...>> {
+    using R = std::invoke_result_t<F, Args...>;
+    auto task = std::packaged_task<R()>{
+        [f = std::forward<F>(f), ...args = std::forward<Args>(args)]() mutable {
+            return std::invoke(std::move(f), std::move(args)...); }};
+    auto future = task.get_future();
+    push(Task{std::move(task)});
+    return future;
+}
+
+template <typename T>
+auto ThreadPool::get(std::future<T> & future) -> T {
+    using namespace std::chrono_literals;
+    auto const self = currentPool_ == this ? currentWorker_ : 0;
+    while (future.wait_for(0s) != std::future_status::ready) {
+        if (auto task = tryPop(self)) (*task)();
+        else std::this_thread::yield();
+    }
+    return future.get();
+}
+
+void ThreadPool::push(Task task) {
+    auto const target = currentPool_ == this ? currentWorker_  // nested: keep it local
+                                             : nextQueue_++ % queues_.size();
+    {
+        auto lock = std::scoped_lock{queues_[target]->mutex};
+        queues_[target]->tasks.push_back(std::move(task));
+    }
+    {
+        auto lock = std::scoped_lock{sleepMutex_};  // under the lock, so no wake up gets lost
+        ++pending_;
+    }
+    wakeUp_.notify_one();
+}
+
+auto ThreadPool::tryPop(std::size_t self) -> std::optional<Task> {
+    {   // own queue, newest first
+        auto & own = *queues_[self];
+        auto lock = std::scoped_lock{own.mutex};
+        if (!own.tasks.empty()) {
+            auto task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --pending_;
+            return task;
+        }
+    }
+    for (auto i = 1u; i < queues_.size(); ++i) {  // steal, oldest first
+        auto & victim = *queues_[(self + i) % queues_.size()];
+        auto lock = std::scoped_lock{victim.mutex};
+        if (!victim.tasks.empty()) {
+            auto task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --pending_;
+            return task;
+        }
+    }
+    return std::nullopt;
+}
+
+void ThreadPool::workerLoop(std::size_t self) {
+    currentPool_ = this;
+    currentWorker_ = self;
+    while (true) {
+        if (auto task = tryPop(self)) {
+            (*task)();
+            continue;
+        }
+        auto lock = std::unique_lock{sleepMutex_};
+        wakeUp_.wait(lock, [this] { return stop_ || pending_ > 0; });
+        if (stop_ && pending_ == 0) return;
+    }
+}
+
+//-------------------------------------------------------------------------------------------Example
+// as in Concurrency_ReturnDataAndExceptions.cpp
+
+auto divide_2(int a, int b) {
+    if (b == 0)
+        throw std::runtime_error{"dived by 0"};
+    return a / b;
+}
+
+// nested submission: split the range until it is small, then sum it up
+auto parallel_sum(ThreadPool & pool, long long first, long long last) -> long long {
+    if (last - first <= 10'000) {
+        auto sum = 0ll;
+        for (auto i = first; i < last; ++i) sum += i;
+        return sum;
+    }
+    auto const middle = first + (last - first) / 2;
+    auto left = pool.submit(parallel_sum, std::ref(pool), first, middle);
+    auto const right = parallel_sum(pool, middle, last);
+    return pool.get(left) + right;
+}
+
+auto noop(int i) { return i; }
+
+//--------------------------------------------------------------------------------------------Try It
+
+int main() {
+    auto pool = ThreadPool{};
+    std::cout << "workers: " << pool.size() << '\n';
+
+    // exceptions propagate as with std::packaged_task / std::async
+    for (auto const divisor : {5, 0}) {
+        auto f = pool.submit(divide_2, 45, divisor);
+        try {
+            const auto & result = f.get();  // blocking
+            std::cout << "pool result: " << result << '\n';
+        }
+        catch (std::exception const & e) {
+            std::cout << "exception: " << e.what() << '\n';
+        }
+    }
+
+    {
+        auto f = pool.submit(parallel_sum, std::ref(pool), 0ll, 10'000'000ll);
+        std::cout << "nested sum: " << f.get() << '\n';  // 49999995000000
+    }
+
+    // throughput: submit many tiny tasks, then wait for all of them
+    constexpr auto numTasks = 10'000;
+    auto results = std::vector<std::future<int>>(numTasks);
+    auto checksum = 0ll;
+    {
+        ScopedTimer t{"throughput, pool"};         //   8248us
+        for (auto i = 0; i < numTasks; ++i) results[i] = pool.submit(noop, i);
+        for (auto & f : results) checksum += f.get();
+    }
+    {
+        ScopedTimer t{"throughput, std::async"};   // 637759us
+        for (auto i = 0; i < numTasks; ++i) results[i] = std::async(std::launch::async, noop, i);
+        for (auto & f : results) checksum += f.get();
+    }
+    {
+        ScopedTimer t{"throughput, std::thread"};  // 544414us
+        for (auto i = 0; i < numTasks; ++i) {
+            auto task = std::packaged_task<int(int)>{noop};
+            results[i] = task.get_future();
+            std::thread(std::move(task), i).detach();
+        }
+        for (auto & f : results) checksum += f.get();
+    }
+
+    // latency: submit one task and wait for it before submitting the next one
+    constexpr auto numRoundTrips = 1'000;
+    {
+        ScopedTimer t{"latency x 1000, pool"};         //  5021us
+        for (auto i = 0; i < numRoundTrips; ++i) checksum += pool.submit(noop, i).get();
+    }
+    {
+        ScopedTimer t{"latency x 1000, std::async"};   // 20112us
+        for (auto i = 0; i < numRoundTrips; ++i) checksum += std::async(std::launch::async, noop, i).get();
+    }
+    {
+        ScopedTimer t{"latency x 1000, std::thread"};  // 22699us
+        for (auto i = 0; i < numRoundTrips; ++i) {
+            auto task = std::packaged_task<int(int)>{noop};
+            auto f = task.get_future();
+            std::thread(std::move(task), i).detach();
+            checksum += f.get();
+        }
+    }
+    std::cout << checksum << '\n';
+}
@@ -0,0 +1,387 @@
+/* What does dispatch cost? virtual vs CRTP vs type erasure vs policies vs variant vs function table
+ *
+ * dynamic polymorphism, static polymorphism, type erasure, variant, benchmark, branch prediction, perf counters
+ *
+ * motivator: TypeErasure_DynamicPolymorphism.cpp, CRTP.cpp, TypeErasure_DuckTyping.cpp, Policies.cpp
+ *
+ * The same workload (sum up the areas of 1'000'000 circles, squares and
+ * triangles) runs through every dispatch style of this repository:
+ *  - virtual:       vector<unique_ptr<Shape>>, one heap object per shape
+ *  - type erasure:  vector<PolymorphicWrapper>, as in TypeErasure_DuckTyping.cpp
+ *  - variant:       vector<variant<Circle, Square, Triangle>> and std::visit
+ *  - fn table:      a type tag per shape indexing an array of function pointers
+ *  - CRTP:          `area()` dispatched statically via `Base<Derived>`
+ *  - policies:      `Host<AreaPolicy>`, the area formula injected as policy
+ * CRTP and policies bind at compile time, so a container can only hold one
+ * type. They keep one vector per type, which is the fastest possible layout
+ * but loses the order of the shapes (see also TypeErasure_PolyCollection.cpp).
+ * The shapes come in three mixes:
+ *  - homogeneous: circles only, every call goes to the same function
+ *  - sorted:      all circles, then all squares, then all triangles
+ *  - random:      types in random order, indirect calls are hard to predict
+ * Where the kernel allows it (`perf_event_open`, see
+ * /proc/sys/kernel/perf_event_paranoid), instructions and branch misses per
+ * shape are reported as well.
+ * Linux only (for the counters).
+ *
+ * compile using `g++ --std=c++20 -O3`
+ */
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <random>
+#include <string>
+#include <tuple>
+#include <variant>
+#include <vector>
+using namespace std;
+
+//----------------------------------------------------------------------------------------PerfCounters
+// instructions and branch misses of the calling thread, in user space
+
+class PerfCounters {
+public:
+    PerfCounters() {
+        instructions_ = open(PERF_COUNT_HW_INSTRUCTIONS, -1);
+        if (instructions_ >= 0) branchMisses_ = open(PERF_COUNT_HW_BRANCH_MISSES, instructions_);
+    }
+    ~PerfCounters() {
+        if (branchMisses_ >= 0) close(branchMisses_);
+        if (instructions_ >= 0) close(instructions_);
+    }
+    PerfCounters(PerfCounters const &)            = delete;
+    PerfCounters& operator=(PerfCounters const &) = delete;
+
+    bool available() const { return instructions_ >= 0 && branchMisses_ >= 0; }
+
+    void start() {
+        if (!available()) return;
+        ioctl(instructions_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(instructions_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    struct Counts { std::uint64_t instructions, branchMisses; };
+
+    auto stop() -> std::optional<Counts> {
+        if (!available()) return std::nullopt;
+        ioctl(instructions_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        auto counts = Counts{};
+        if (read(instructions_, &counts.instructions, sizeof(std::uint64_t)) != sizeof(std::uint64_t)
+            || read(branchMisses_, &counts.branchMisses, sizeof(std::uint64_t)) != sizeof(std::uint64_t))
+            return std::nullopt;
+        return counts;
+    }
+
+private:
+    static int open(std::uint64_t config, int groupLeader) {
+        auto attributes = perf_event_attr{};
+        attributes.size = sizeof(attributes);
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = config;
+        attributes.disabled = groupLeader < 0;  // the group is enabled via its leader
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, groupLeader, 0));
+    }
+
+    int instructions_ = -1;
+    int branchMisses_ = -1;
+};
+
+//-------------------------------------------------------------------------------------------Shapes
+
+enum class Kind : std::uint8_t { circle, square, triangle };
+
+struct ShapeData {  // what every mechanism is built from
+    Kind kind;
+    double size;
+};
+
+double circleArea(double r)   { return std::numbers::pi * r * r; }
+double squareArea(double s)   { return s * s; }
+double triangleArea(double s) { return s * s / 2; }
+
+//------------------------------------------------------------virtual, TypeErasure_DynamicPolymorphism.cpp
+namespace dynamic {
+
+struct Shape {
+    virtual ~Shape() = default;
+    virtual double area() const = 0;
+};
+
+struct Circle : Shape {
+    explicit Circle(double r) : radius{r} {}
+    double area() const override { return circleArea(radius); }
+    double radius;
+};
+
+struct Square : Shape {
+    explicit Square(double s) : side{s} {}
+    double area() const override { return squareArea(side); }
+    double side;
+};
+
+struct Triangle : Shape {
+    explicit Triangle(double s) : side{s} {}
+    double area() const override { return triangleArea(side); }
+    double side;
+};
+
+struct Shapes {
+    explicit Shapes(vector<ShapeData> const & data) {
+        for (auto [kind, size] : data)
+            switch (kind) {
+                case Kind::circle:   shapes.push_back(make_unique<Circle>(size));   break;
+                case Kind::square:   shapes.push_back(make_unique<Square>(size));   break;
+                case Kind::triangle: shapes.push_back(make_unique<Triangle>(size)); break;
+            }
+    }
+    double totalArea() const {
+        auto sum = 0.0;
+        for (auto const & shape : shapes) sum += shape->area();
+        return sum;
+    }
+    vector<unique_ptr<Shape>> shapes;
+};
+
+}  // namespace dynamic
+
+//--------------------------------------------------------------type erasure, TypeErasure_DuckTyping.cpp
+namespace erasure {
+
+template <typename T>
+concept AreaRetrievable = requires (T const& obj) {
+    { obj.area() } -> std::same_as<double>;
+};
+
+struct PolymorphicWrapper {
+    template <AreaRetrievable T>
+    PolymorphicWrapper(T const & obj) : wrapped_{make_shared<Model<T>>(obj)} {}
+
+    double area() const { return wrapped_->area(); }
+
+private:
+    struct Concept {
+        virtual ~Concept() = default;
+        virtual double area() const = 0;
+    };
+
+    template <AreaRetrievable T>
+    struct Model : Concept {
+        Model(T const & obj) : object_{obj} {}
+        double area() const override { return object_.area(); }
+    private:
+        T object_;
+    };
+
+    std::shared_ptr<Concept> wrapped_;
+};
+
+struct Circle   { double area() const { return circleArea(radius); } double radius; };
+struct Square   { double area() const { return squareArea(side); }   double side; };
+struct Triangle { double area() const { return triangleArea(side); } double side; };
+
+struct Shapes {
+    explicit Shapes(vector<ShapeData> const & data) {
+        for (auto [kind, size] : data)
+            switch (kind) {
+                case Kind::circle:   shapes.push_back(Circle{size});   break;
+                case Kind::square:   shapes.push_back(Square{size});   break;
+                case Kind::triangle: shapes.push_back(Triangle{size}); break;
+            }
+    }
+    double totalArea() const {
+        auto sum = 0.0;
+        for (auto const & shape : shapes) sum += shape.area();
+        return sum;
+    }
+    vector<PolymorphicWrapper> shapes;
+};
+
+}  // namespace erasure
+
+//------------------------------------------------------------------------------------variant + visit
+namespace visiting {
+
+struct Circle   { double area() const { return circleArea(radius); } double radius; };
+struct Square   { double area() const { return squareArea(side); }   double side; };
+struct Triangle { double area() const { return triangleArea(side); } double side; };
+
+struct Shapes {
+    explicit Shapes(vector<ShapeData> const & data) {
+        for (auto [kind, size] : data)
+            switch (kind) {
+                case Kind::circle:   shapes.emplace_back(Circle{size});   break;
+                case Kind::square:   shapes.emplace_back(Square{size});   break;
+                case Kind::triangle: shapes.emplace_back(Triangle{size}); break;
+            }
+    }
+    double totalArea() const {
+        auto sum = 0.0;
+        for (auto const & shape : shapes) sum += std::visit([](auto const & s) { return s.area(); }, shape);
+        return sum;
+    }
+    vector<std::variant<Circle, Square, Triangle>> shapes;
+};
+
+}  // namespace visiting
+
+//-------------------------------------------------------------------------------function pointer table
+namespace table {
+
+constexpr auto areas = std::array<double (*)(double), 3>{circleArea, squareArea, triangleArea};
+
+struct Shapes {
+    explicit Shapes(vector<ShapeData> const & data) : shapes{data} {}
+    double totalArea() const {
+        auto sum = 0.0;
+        for (auto [kind, size] : shapes) sum += areas[static_cast<std::size_t>(kind)](size);
+        return sum;
+    }
+    vector<ShapeData> shapes;
+};
+
+}  // namespace table
+
+//--------------------------------------------------------------------------------------CRTP, CRTP.cpp
+namespace crtp {
+
+template <typename Derived>
+struct Shape {
+    double area() const { return static_cast<Derived const*>(this)->impl(); }
+};
+
+struct Circle   : Shape<Circle>   { double impl() const { return circleArea(radius); } double radius; };
+struct Square   : Shape<Square>   { double impl() const { return squareArea(side); }   double side; };
+struct Triangle : Shape<Triangle> { double impl() const { return triangleArea(side); } double side; };
+
+template <typename Derived>
+double totalArea(vector<Derived> const & shapes) {
+    auto sum = 0.0;
+    for (auto const & shape : shapes) sum += shape.area();
+    return sum;
+}
+
+struct Shapes {
+    explicit Shapes(vector<ShapeData> const & data) {
+        for (auto [kind, size] : data)
+            switch (kind) {
+                case Kind::circle:   std::get<0>(shapes).push_back(Circle{{}, size});   break;
+                case Kind::square:   std::get<1>(shapes).push_back(Square{{}, size});   break;
+                case Kind::triangle: std::get<2>(shapes).push_back(Triangle{{}, size}); break;
+            }
+    }
+    double totalArea() const {
+        return std::apply([](auto const & ... vectors) { return (0.0 + ... + crtp::totalArea(vectors)); }, shapes);
+    }
+    std::tuple<vector<Circle>, vector<Square>, vector<Triangle>> shapes;
+};
+
+}  // namespace crtp
+
+//----------------------------------------------------------------------------------policies, Policies.cpp
+namespace policies {
+
+struct CirclePolicy   { static double area(double size) { return circleArea(size); } };
+struct SquarePolicy   { static double area(double size) { return squareArea(size); } };
+struct TrianglePolicy { static double area(double size) { return triangleArea(size); } };
+
+template <typename AreaPolicy>
+struct Host : private AreaPolicy {
+    explicit Host(double s) : size{s} {}
+    double area() const { return AreaPolicy::area(size); }
+    double size;
+};
+
+template <typename Policy>
+double totalArea(vector<Host<Policy>> const & shapes) {
+    auto sum = 0.0;
+    for (auto const & shape : shapes) sum += shape.area();
+    return sum;
+}
+
+struct Shapes {
+    explicit Shapes(vector<ShapeData> const & data) {
+        for (auto [kind, size] : data)
+            switch (kind) {
+                case Kind::circle:   std::get<0>(shapes).emplace_back(size); break;
+                case Kind::square:   std::get<1>(shapes).emplace_back(size); break;
+                case Kind::triangle: std::get<2>(shapes).emplace_back(size); break;
+            }
+    }
+    double totalArea() const {
+        return std::apply([](auto const & ... vectors) { return (0.0 + ... + policies::totalArea(vectors)); }, shapes);
+    }
+    std::tuple<vector<Host<CirclePolicy>>, vector<Host<SquarePolicy>>, vector<Host<TrianglePolicy>>> shapes;
+};
+
+}  // namespace policies
+
+//--------------------------------------------------------------------------------------------Try It
+
+constexpr auto numShapes = 1'000'000;
+constexpr auto repetitions = 10;
+
+auto makeMix(string const & mix) {
+    auto engine = std::mt19937{42};
+    auto data = vector<ShapeData>(numShapes);
+    for (auto & [kind, size] : data) {
+        kind = mix == "homogeneous" ? Kind::circle : static_cast<Kind>(engine() % 3);
+        size = 1.0 + engine() % 10;
+    }
+    if (mix == "sorted")
+        std::ranges::sort(data, {}, &ShapeData::kind);
+    return data;
+}
+
+template <typename Shapes>
+void measure(char const * mechanism, vector<ShapeData> const & data, PerfCounters & counters) {
+    using namespace std::chrono;
+    auto const shapes = Shapes{data};
+    auto sum = shapes.totalArea();  // warm up
+    counters.start();
+    auto const start = steady_clock::now();
+    for (auto i = 0; i < repetitions; ++i) sum += shapes.totalArea();
+    auto const us = duration_cast<microseconds>(steady_clock::now() - start).count();
+    auto const counts = counters.stop();
+
+    constexpr auto calls = double(numShapes) * repetitions;
+    cout << std::left << std::setw(14) << mechanism << std::right << std::setw(8) << us / repetitions;
+    if (counts) cout << std::fixed << std::setprecision(2)
+                     << std::setw(10) << counts->instructions / calls
+                     << std::setw(10) << counts->branchMisses / calls << std::defaultfloat;
+    else cout << "       n/a       n/a";
+    cout << "   (" << sum << ")\n";
+}
+
+int main() {
+    auto counters = PerfCounters{};
+    for (auto mix : {"homogeneous", "sorted", "random"}) {
+        auto const data = makeMix(mix);
+        cout << '\n' << mix << "\nmechanism     us/pass  instr/shape  misses/shape\n";
+        measure<dynamic::Shapes>("virtual", data, counters);
+        measure<erasure::Shapes>("type erasure", data, counters);
+        measure<visiting::Shapes>("variant", data, counters);
+        measure<table::Shapes>("fn table", data, counters);
+        measure<crtp::Shapes>("CRTP", data, counters);
+        measure<policies::Shapes>("policies", data, counters);
+    }
+    // -O3, perf counters not available on this VM:
+    //                virtual  type erasure  variant  fn table  CRTP  policies   (us per pass)
+    // homogeneous       6039          8304     2937      4695  1074       995
+    // sorted            6284          8475     3245      5183   961       955
+    // random           16339         17140     9998     12737  1061      1925
+    // Mispredicted indirect calls cost the dynamic mechanisms a factor 2-3 for
+    // random mixes. The static ones don't care, they see no mix at all.
+}
@@ -0,0 +1,339 @@
+/* A blocked Bloom filter in front of any container for negative lookups
+ *
+ * Bloom filter, probabilistic data structures, hashing, SIMD, cache friendly, generic programming, performance
+ *
+ * motivation: GenericAlgorithms.cpp
+ *
+ * If most queries of `contains` come back false, most of the work of a scan
+ * or a hash lookup is wasted. A Bloom filter answers "certainly not" or
+ * "maybe" for a small, fixed cost: each key sets k bits in a bit array; if
+ * one of the k bits of a query is not set, the key was never added. If all
+ * are set, the query is a false positive with a probability that depends on
+ * the bits per key.
+ * A classic Bloom filter scatters the k bits over the whole array, so a
+ * query touches up to k cache lines. The blocked (split block) Bloom filter
+ * here hashes a key to one block of 8 words of 32 bits, which lies within a
+ * cache line, and sets exactly one bit in each word. The 8 bit positions are
+ * computed from the hash with 8 multiplications by odd constants; with AVX2
+ * this is one `vpmulld`, one shift, one `vpsllvd` and one `vptest`, i.e. a
+ * query is a handful of instructions and one cache miss at most. Without
+ * AVX2 a loop over the 8 words without an early exit does the same.
+ * Blocks fill unevenly, so a blocked filter has a somewhat higher false
+ * positive rate than a classic one with the same bits per key.
+ * `blocked_bloom_filter(n, fpr)` picks the number of blocks for the target
+ * false positive rate `fpr` from the expected rate of the blocked layout
+ * (the keys per block follow a Poisson distribution).
+ * `filtered_set<Container>` puts such a filter in front of any container:
+ * `contains` asks the filter first and only the "maybe"s reach the
+ * container. Bloom filters cannot forget keys, so `filtered_set` can
+ * insert, but not erase. Once more keys were inserted than the filter was
+ * sized for, its false positive rate would climb, so `filtered_set`
+ * rebuilds it from the container for twice as many keys (amortized O(1)
+ * per insert, like the growth of a `std::vector`).
+ *
+ * compile using `g++ --std=c++20 -O3 -march=native`
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <ranges>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+using namespace std;
+
+//---------------------------------------------------------------------------------GenericAlgorithms
+// GenericAlgorithms.cpp
+
+template <typename Iterator, typename T>
+auto contains(Iterator begin, Iterator end, T const & value) {
+    while (begin != end)
+        if (*begin++ == value)
+            return true;
+    return false;
+}
+
+template <typename C, typename T>
+concept HasMemberContains = requires(C const & c, T const & value) {
+    { c.contains(value) } -> std::convertible_to<bool>;
+};
+
+// associative containers (and filtered_set) know best
+template <typename C, typename T>
+    requires HasMemberContains<C, T>
+auto contains(C const & c, T const & value) -> bool {
+    return c.contains(value);
+}
+
+template <std::ranges::range R, typename T>
+    requires (!HasMemberContains<R, T>)
+auto contains(R const & r, T const & value) -> bool {
+    return contains(std::begin(r), std::end(r), value);
+}
+
+//--------------------------------------------------------------------------------------BloomFilter
+
+template <typename T, typename Hash = std::hash<T>>
+class blocked_bloom_filter {
+public:
+    static constexpr std::size_t words = 8;  // of 32 bits, one bit per key in each
+
+    struct alignas(32) Block {  // never crosses a cache line
+        std::uint32_t word[words];
+    };
+
+    // for `expectedKeys` keys with a false positive rate of at most `fpr`
+    blocked_bloom_filter(std::size_t const expectedKeys, double const fpr)
+        : numBlocks_{blocksFor(expectedKeys, fpr)}, blocks_{new Block[numBlocks_]{}} {}
+
+    void insert(T const & key) noexcept {
+        auto const h = hash(key);
+        auto & block = blocks_[blockIndex(h)];
+        auto const m = masks(static_cast<std::uint32_t>(h));
+        for (auto i = std::size_t{0}; i < words; ++i) block.word[i] |= m[i];
+    }
+
+    // false: certainly not inserted, true: maybe
+    bool may_contain(T const & key) const noexcept {
+        auto const h = hash(key);
+        auto const & block = blocks_[blockIndex(h)];
+#ifdef __AVX2__
+        auto const salts = _mm256_setr_epi32(salt[0], salt[1], salt[2], salt[3], salt[4], salt[5], salt[6], salt[7]);
+        auto const bits = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(static_cast<int>(h)), salts), 27);
+        auto const mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
+        auto const b = _mm256_load_si256(reinterpret_cast<__m256i const*>(&block));
+        return _mm256_testc_si256(b, mask);  // (~b & mask) == 0
+#else
+        auto const m = masks(static_cast<std::uint32_t>(h));
+        auto missing = std::uint32_t{0};
+        for (auto i = std::size_t{0}; i < words; ++i) missing |= m[i] & ~block.word[i];  // no early exit: vectorized
+        return missing == 0;
+#endif
+    }
+
+    auto bytes() const noexcept { return numBlocks_ * sizeof(Block); }
+
+    // the false positive rate of `numBlocks` blocks holding `keys` keys
+    static double expectedFpr(std::size_t const keys, std::size_t const numBlocks) {
+        auto const lambda = static_cast<double>(keys) / static_cast<double>(numBlocks);  // keys per block
+        auto fpr = 0.0;
+        auto poisson = std::exp(-lambda);  // P(j keys in a block)
+        for (auto j = 0; j < 1000 && (j < lambda || poisson > 1e-12); ++j) {
+            fpr += poisson * std::pow(1.0 - std::pow(1.0 - 1.0 / 32, j), static_cast<double>(words));
+            poisson *= lambda / (j + 1);
+        }
+        return fpr;
+    }
+
+private:
+    static constexpr std::uint32_t salt[words] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                                                  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+    static std::size_t blocksFor(std::size_t const keys, double const fpr) {
+        auto numBlocks = std::max<std::size_t>(1, keys / 64);
+        while (expectedFpr(keys, numBlocks) > fpr) numBlocks += numBlocks / 16 + 1;
+        return numBlocks;
+    }
+
+    // std::hash of integers is the identity, mix the bits (the finalizer of MurmurHash3)
+    static std::uint64_t hash(T const & key) noexcept {
+        auto h = static_cast<std::uint64_t>(Hash{}(key));
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        return h ^ (h >> 33);
+    }
+
+    // the high 32 bits select the block, without a division
+    std::size_t blockIndex(std::uint64_t const h) const noexcept {
+        return static_cast<std::size_t>(((h >> 32) * numBlocks_) >> 32);
+    }
+
+    // the low 32 bits select one bit in each word, with the highest 5 bits of a multiplication
+    static std::array<std::uint32_t, words> masks(std::uint32_t const h) noexcept {
+        auto m = std::array<std::uint32_t, words>{};
+        for (auto i = std::size_t{0}; i < words; ++i) m[i] = std::uint32_t{1} << ((h * salt[i]) >> 27);
+        return m;
+    }
+
+    std::size_t numBlocks_;
+    std::unique_ptr<Block[]> blocks_;
+};
+
+//-------------------------------------------------------------------------------------filtered_set
+
+template <std::ranges::range Container,
+          typename Hash = std::hash<std::ranges::range_value_t<Container>>>
+class filtered_set {
+public:
+    using value_type = std::ranges::range_value_t<Container>;
+
+    // the filter is sized for `expectedKeys`, at least the size of `container`, and grows beyond
+    explicit filtered_set(Container container, double const fpr = 0.01, std::size_t const expectedKeys = 0)
+        : container_{std::move(container)},
+          fpr_{fpr},
+          keys_{static_cast<std::size_t>(std::ranges::distance(container_))},
+          capacity_{std::max(expectedKeys, keys_)},
+          filter_{capacity_, fpr_} {
+        for (auto const & value : container_) filter_.insert(value);
+    }
+
+    bool contains(value_type const & key) const {
+        return filter_.may_contain(key) && ::contains(container_, key);
+    }
+
+    template <typename V>
+        requires requires(Container & c, V && v) { c.insert(std::forward<V>(v)); }
+    void insert(V && value) {
+        filter_.insert(value);
+        container_.insert(std::forward<V>(value));
+        grow();
+    }
+
+    template <typename V>
+        requires requires(Container & c, V && v) { c.push_back(std::forward<V>(v)); }
+    void push_back(V && value) {
+        filter_.insert(value);
+        container_.push_back(std::forward<V>(value));
+        grow();
+    }
+
+    Container const & container() const noexcept { return container_; }
+    auto const & filter() const noexcept { return filter_; }
+
+private:
+    // counts duplicates too, which at worst rebuilds a little early
+    void grow() {
+        if (++keys_ <= capacity_) return;
+        capacity_ = 2 * keys_;
+        filter_ = blocked_bloom_filter<value_type, Hash>(capacity_, fpr_);
+        for (auto const & value : container_) filter_.insert(value);
+    }
+
+    Container container_;
+    double fpr_;
+    std::size_t keys_;      // inserted into the filter
+    std::size_t capacity_;  // the filter is sized for
+    blocked_bloom_filter<value_type, Hash> filter_;
+};
+
+static_assert(HasMemberContains<filtered_set<std::vector<int>>, int>);
+
+//---------------------------------------------------------------------------------------------Try It
+
+template <typename F>
+void measure(char const * name, std::size_t size, std::size_t queries, F f) {
+    auto found = std::size_t{0};
+    auto const start = std::chrono::steady_clock::now();
+    for (auto q = std::size_t{0}; q < queries; ++q) found += f(q);
+    auto const ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  " << std::setw(24) << std::left << name << std::right << std::setw(9) << size
+              << std::setw(12) << std::fixed << std::setprecision(1) << ns / static_cast<double>(queries)
+              << " ns/query, " << found << " found\n";
+}
+
+// distinct random keys, the first `size` of them are in the set, the others never
+auto randomKeys(std::size_t const count, std::mt19937 & engine) {
+    auto seen = std::unordered_set<int>{};
+    auto keys = std::vector<int>{};
+    auto any = std::uniform_int_distribution<int>{0, std::numeric_limits<int>::max()};
+    while (keys.size() < count)
+        if (auto const k = any(engine); seen.insert(k).second) keys.push_back(k);
+    return keys;
+}
+
+void falsePositiveRates() {
+    auto engine = std::mt19937{7};
+    auto const size = std::size_t{1'000'000};
+    auto const keys = randomKeys(2 * size, engine);
+    std::cout << "false positive rates, " << size << " keys\n";
+    for (auto const fpr : {0.1, 0.01, 0.001, 0.0001}) {
+        auto filter = blocked_bloom_filter<int>(size, fpr);
+        for (auto i = std::size_t{0}; i < size; ++i) filter.insert(keys[i]);
+        auto missed = std::size_t{0}, positives = std::size_t{0};
+        for (auto i = std::size_t{0}; i < size; ++i) missed += !filter.may_contain(keys[i]);
+        for (auto i = size; i < 2 * size; ++i) positives += filter.may_contain(keys[i]);
+        std::cout << "  target " << std::setw(6) << std::defaultfloat << fpr << ": measured " << std::fixed
+                  << std::setprecision(5) << static_cast<double>(positives) / static_cast<double>(size)
+                  << ", " << std::setprecision(1) << 8.0 * static_cast<double>(filter.bytes()) / static_cast<double>(size)
+                  << " bits/key, " << missed << " false negatives\n";
+    }
+}
+
+// 99% of the queries are not in the set
+void benchmark() {
+    auto engine = std::mt19937{42};
+    for (auto const size : {std::size_t{1'000}, std::size_t{100'000}, std::size_t{1'000'000}}) {
+        auto const keys = randomKeys(size + (1 << 16), engine);
+        auto const values = std::vector<int>(keys.begin(), keys.begin() + static_cast<std::ptrdiff_t>(size));
+        auto queries = std::vector<int>(1 << 16);
+        auto pick = std::uniform_int_distribution<std::size_t>{0, size - 1};
+        for (auto i = std::size_t{0}; i < queries.size(); ++i) queries[i] = i % 100 == 0 ? values[pick(engine)] : keys[size + i];
+        auto const query = [&](std::size_t q) { return queries[q % queries.size()]; };
+        auto const numScans = std::max<std::size_t>(1 << 10, (std::size_t{1} << 27) / size);
+        auto const numLookups = std::size_t{1} << 22;
+
+        auto const ordered = std::set<int>(values.begin(), values.end());
+        auto const unordered = std::unordered_set<int>(values.begin(), values.end());
+        auto const filteredVector = filtered_set{values};
+        auto const filteredOrdered = filtered_set{ordered};
+        auto const filteredUnordered = filtered_set{unordered};
+
+        measure("linear scan", size, numScans, [&](std::size_t q) { return contains(values, query(q)); });
+        measure("filtered linear scan", size, queries.size(), [&](std::size_t q) { return contains(filteredVector, query(q)); });
+        measure("std::set", size, numLookups, [&](std::size_t q) { return contains(ordered, query(q)); });
+        measure("filtered std::set", size, numLookups, [&](std::size_t q) { return contains(filteredOrdered, query(q)); });
+        measure("unordered_set", size, numLookups, [&](std::size_t q) { return contains(unordered, query(q)); });
+        measure("filtered unordered_set", size, numLookups, [&](std::size_t q) { return contains(filteredUnordered, query(q)); });
+    }
+}
+
+int main() {
+    auto words = filtered_set{std::set<std::string>{"alpha", "beta", "gamma"}, 0.01, 4};  // room for "delta"
+    words.insert("delta");
+    cout << boolalpha << contains(words, "beta") << ' ' << contains(words, "delta") << ' '
+         << contains(words, "omega") << '\n';  // true true false
+
+    // sized for 1000 keys, the filter is rebuilt as the vector grows and keeps its false positive rate
+    auto numbers = filtered_set{std::vector<int>{}, 0.01, 1000};
+    for (auto i = 0; i < 100'000; ++i) numbers.push_back(2 * i);
+    auto found = 0, positives = 0;
+    for (auto i = 0; i < 200'000; ++i) {
+        if (i % 2 == 0) found += numbers.filter().may_contain(i);
+        else positives += numbers.filter().may_contain(i);
+    }
+    cout << found << " found, " << positives << " false positives in 100000\n";  // 100000, 322; without
+    // rebuilding the filter of 1000 keys is full: 100000 false positives
+
+    falsePositiveRates();
+    benchmark();
+}
+
+// ns per query, 99% misses, filter for 1% false positives (10.6 bits/key), -O3 -march=native (-O0):
+//                             1'000                 100'000                 1'000'000
+// linear scan            778.2 (12499.1)    82884.0 (1289290.2)    564513.6 (12457013.5)
+// filtered linear scan    17.9   (312.7)     1575.0   (21945.1)     17409.2   (191013.7)
+// std::set                91.8   (337.8)      471.6    (1088.5)      1788.4     (2129.1)
+// filtered std::set        6.1   (157.2)       10.2     (179.8)        25.3      (199.6)
+// unordered_set           31.2   (154.6)       46.7     (394.2)       120.4      (545.0)
+// filtered unordered_set   5.2   (147.7)        6.7     (166.1)        11.9      (123.3)
+// Without -march=native (no AVX2) the filtered lookups take 2 to 3 times longer, e.g. 14.9 and 39.5 ns
+// for the filtered unordered_set, still 2 to 3 times faster than the unordered_set alone.
+// The measured false positive rates match the targets: 0.093, 0.0100, 0.00092, 0.00008 for 0.1 to 0.0001.
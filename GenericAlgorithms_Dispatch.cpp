@@ -0,0 +1,262 @@
+/* A generic contains() that picks the algorithm at compile time
+ *
+ * generic programming, templates, concepts, if constexpr, tag dispatch, vectorization, binary search, performance
+ *
+ * motivation: GenericAlgorithms.cpp
+ *
+ * `contains` of GenericAlgorithms.cpp compares element by element,
+ * `*begin++ == value`, no matter what it searches. It is always correct, but
+ * often not the best we can do. Here `contains(range, value)` looks at the
+ * type of the range and of the value and picks, in this order:
+ *  - the member function: associative containers like std::set or
+ *    std::unordered_map know best where an element is (`r.contains(x)`, or
+ *    `r.find(x) != r.end()` for containers without `contains`)
+ *  - a branchless binary search for ranges declared to be sorted with
+ *    `assume_sorted(range)`: the comparison selects the next half with a
+ *    conditional move instead of a branch, so there are no mispredictions,
+ *    and the loop runs exactly log2(n) times
+ *  - a SIMD scan for contiguous ranges of arithmetic elements of the type of
+ *    the value: the elements are compared in blocks of `block` elements
+ *    without an early exit inside the block, which the compiler turns into
+ *    vector compares (`vpcmpeqd` and friends, with -march=native); only
+ *    after each block it checks whether there was a match
+ *  - the linear scan of GenericAlgorithms.cpp for everything else
+ * `strategy<Range, T>` tells which one is used. The dispatch happens at
+ * compile time with `if constexpr` and concepts, there is no runtime cost.
+ * The SIMD scan compares with `==`, so the results are those of the linear
+ * scan, also for -0.0 == 0.0 and NaN != NaN. The binary search requires the
+ * range to be sorted by `<`, as std::binary_search does.
+ *
+ * compile using `g++ --std=c++20 -O3 -march=native`
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <map>
+#include <random>
+#include <ranges>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+using namespace std;
+
+//---------------------------------------------------------------------------------GenericAlgorithms
+// GenericAlgorithms.cpp
+
+template <typename Iterator, typename T>
+auto linear_contains(Iterator begin, Iterator end, T const & value) {
+    while (begin != end)
+        if (*begin++ == value)
+            return true;
+    return false;
+}
+
+auto linear_contains(std::ranges::range auto const & r, auto const & x) {
+    return linear_contains(std::begin(r), std::end(r), x);
+}
+
+//--------------------------------------------------------------------------------------------Sorted
+
+// a promise that `base` is sorted by `<`
+template <std::ranges::view V>
+class sorted_view : public std::ranges::view_interface<sorted_view<V>> {
+public:
+    explicit sorted_view(V base) : base_{std::move(base)} {}
+
+    auto begin() const { return std::ranges::begin(base_); }
+    auto end()   const { return std::ranges::end(base_); }
+
+private:
+    V base_;
+};
+
+template <std::ranges::random_access_range R>
+    requires std::ranges::sized_range<R>
+auto assume_sorted(R && range) {
+    return sorted_view{std::views::all(std::forward<R>(range))};
+}
+
+template <typename R>
+constexpr bool isSorted = false;
+template <typename V>
+constexpr bool isSorted<sorted_view<V>> = true;
+
+//----------------------------------------------------------------------------------------Algorithms
+
+// the lower bound is in [first, first + n], which halves in every step
+template <std::random_access_iterator Iterator, typename T>
+auto branchless_binary_search(Iterator const begin, std::iter_difference_t<Iterator> const size, T const & value) {
+    if (size == 0) return false;
+    auto first = begin;
+    for (auto n = size; n > 1; ) {
+        auto const half = n / 2;
+        first = first[half] < value ? first + half : first;  // cmov
+        n -= half;
+    }
+    first += *first < value;  // the lower bound
+    return first != begin + size && *first == value;
+}
+
+constexpr std::size_t block = 64;
+
+// the vectorizer only accumulates a `bool` if it is as wide as the compared elements
+template <typename E>
+using mask_t = std::conditional_t<sizeof(E) == 8, std::uint64_t,
+               std::conditional_t<sizeof(E) == 4, std::uint32_t,
+               std::conditional_t<sizeof(E) == 2, std::uint16_t, std::uint8_t>>>;
+
+template <typename E>
+auto simd_contains(E const * const data, std::size_t const n, E const value) {
+    auto i = std::size_t{0};
+    for (; i + block <= n; i += block) {
+        auto found = mask_t<E>{0};
+        for (auto j = std::size_t{0}; j < block; ++j)  // no early exit: vectorized
+            found |= static_cast<mask_t<E>>(data[i + j] == value);
+        if (found) return true;
+    }
+    for (; i < n; ++i)
+        if (data[i] == value) return true;
+    return false;
+}
+
+//------------------------------------------------------------------------------------------Dispatch
+
+enum class Strategy { memberContains, memberFind, binarySearch, simdScan, linearScan };
+
+template <typename R, typename T>
+concept HasMemberContains = requires(R const & r, T const & value) {
+    { r.contains(value) } -> std::convertible_to<bool>;
+};
+
+template <typename R, typename T>
+concept HasMemberFind = requires(R const & r, T const & value) {
+    { r.find(value) } -> std::same_as<std::ranges::iterator_t<R const>>;  // not std::string::find
+};
+
+template <typename R, typename T>
+concept SimdScannable = std::ranges::contiguous_range<R> && std::ranges::sized_range<R>
+                     && std::is_arithmetic_v<std::ranges::range_value_t<R>>
+                     && std::same_as<std::ranges::range_value_t<R>, T>;
+
+template <typename R, typename T>
+constexpr Strategy strategy = [] {
+    using Range = std::remove_cvref_t<R>;
+    if constexpr (HasMemberContains<Range, T>) return Strategy::memberContains;
+    else if constexpr (HasMemberFind<Range, T>) return Strategy::memberFind;
+    else if constexpr (isSorted<Range>) return Strategy::binarySearch;
+    else if constexpr (SimdScannable<Range, T>) return Strategy::simdScan;
+    else return Strategy::linearScan;
+}();
+
+auto operator<<(std::ostream & out, Strategy s) -> std::ostream & {
+    constexpr char const * names[] = {"member contains", "member find", "binary search", "SIMD scan", "linear scan"};
+    return out << names[static_cast<int>(s)];
+}
+
+template <std::ranges::range R, typename T>
+auto contains(R const & r, T const & value) -> bool {
+    constexpr auto s = strategy<R, T>;
+    if constexpr (s == Strategy::memberContains) return r.contains(value);
+    else if constexpr (s == Strategy::memberFind) return r.find(value) != std::ranges::end(r);
+    else if constexpr (s == Strategy::binarySearch)
+        return branchless_binary_search(std::ranges::begin(r), std::ranges::ssize(r), value);
+    else if constexpr (s == Strategy::simdScan) return simd_contains(std::ranges::data(r), std::ranges::size(r), value);
+    else return linear_contains(r, value);
+}
+
+//---------------------------------------------------------------------------------------------Try It
+
+template <typename F>
+void measure(char const * name, std::size_t size, std::size_t queries, F f) {
+    auto found = std::size_t{0};
+    auto const start = std::chrono::steady_clock::now();
+    for (auto q = std::size_t{0}; q < queries; ++q) found += f(q);
+    auto const ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  " << std::setw(18) << std::left << name << std::right << std::setw(9) << size
+              << std::setw(12) << std::fixed << std::setprecision(1) << ns / static_cast<double>(queries)
+              << " ns/query, " << found << " found\n";
+}
+
+template <typename E>
+void benchmark(char const * typeName) {
+    std::cout << typeName << '\n';
+    auto engine = std::mt19937{42};
+    for (auto const size : {std::size_t{16}, std::size_t{1'000}, std::size_t{64'000}, std::size_t{1'000'000}}) {
+        // the even numbers below 2 * distinct, so half the queries miss
+        auto distinct = size;
+        if constexpr (std::is_integral_v<E>) distinct = std::min<std::size_t>(size, std::numeric_limits<E>::max() / 2);
+        auto values = std::vector<E>(size);
+        for (auto i = std::size_t{0}; i < size; ++i) values[i] = static_cast<E>(2 * (i % distinct));
+        std::shuffle(values.begin(), values.end(), engine);
+        auto sorted = values;
+        std::ranges::sort(sorted);
+        auto const set = std::set<E>(values.begin(), values.end());
+
+        auto queries = std::vector<E>(4096);
+        auto any = std::uniform_int_distribution<std::size_t>{0, 2 * distinct - 1};
+        for (auto & q : queries) q = static_cast<E>(any(engine));
+        auto const numScans = std::max<std::size_t>(64, (std::size_t{1} << 25) / size);
+        auto const numLookups = std::size_t{1} << 21;
+        auto const query = [&](std::size_t q) { return queries[q % queries.size()]; };
+
+        measure("linear scan", size, numScans, [&](std::size_t q) { return linear_contains(values, query(q)); });
+        measure("SIMD scan", size, numScans, [&](std::size_t q) { return contains(values, query(q)); });
+        measure("std::set", size, numLookups, [&](std::size_t q) { return contains(set, query(q)); });
+        measure("binary search", size, numLookups, [&](std::size_t q) { return contains(assume_sorted(sorted), query(q)); });
+        measure("std::binary_search", size, numLookups, [&](std::size_t q) {
+            return std::binary_search(sorted.begin(), sorted.end(), query(q)); });
+    }
+}
+
+int main() {
+    // works for vectors, lists, sets, ... as in GenericAlgorithms.cpp
+    auto const v = vector{1, 2, 3};
+    auto const l = list{1, 2, 3};
+    auto const s = set{1, 2, 3};
+    auto const u = unordered_set{1, 2, 3};
+    auto const m = map<int, string>{{1, "one"}, {2, "two"}};
+    auto const str = string{"abc"};
+    cout << boolalpha;
+    cout << contains(v, 1) << ' ' << contains(v, -1) << ": " << strategy<decltype(v), int> << '\n';                   // SIMD scan
+    cout << contains(l, 1) << ' ' << contains(l, -1) << ": " << strategy<decltype(l), int> << '\n';                   // linear scan
+    cout << contains(s, 1) << ' ' << contains(s, -1) << ": " << strategy<decltype(s), int> << '\n';                   // member contains
+    cout << contains(u, 1) << ' ' << contains(u, -1) << ": " << strategy<decltype(u), int> << '\n';                   // member contains
+    cout << contains(m, 1) << ' ' << contains(m, -1) << ": " << strategy<decltype(m), int> << '\n';                   // member contains (the keys)
+    cout << contains(assume_sorted(v), 3) << ' ' << contains(assume_sorted(v), 0) << ": "
+         << strategy<decltype(assume_sorted(v)), int> << '\n';                                                         // binary search
+    cout << contains(str, 'b') << ' ' << contains(str, 'x') << ": " << strategy<decltype(str), char> << '\n';         // SIMD scan
+    cout << contains(v, 1.0) << ": " << strategy<decltype(v), double> << '\n';                                        // linear scan, int == double
+    static_assert(strategy<std::vector<std::string>, std::string> == Strategy::linearScan);
+
+    // the binary search against std::binary_search, for all sizes and positions
+    for (auto n = 0; n < 40; ++n) {
+        auto sorted = std::vector<int>(n);
+        for (auto i = 0; i < n; ++i) sorted[i] = 2 * i;
+        for (auto x = -1; x <= 2 * n; ++x)
+            if (contains(assume_sorted(sorted), x) != std::binary_search(sorted.begin(), sorted.end(), x))
+                cout << "binary search is wrong for n = " << n << ", x = " << x << '\n';
+    }
+
+    benchmark<char>("char");
+    benchmark<int>("int");
+    benchmark<double>("double");
+}
+
+// ns per query, -O3 -march=native, int (double):
+//                        16              1'000             64'000                1'000'000
+// linear scan      19.6 (18.9)   1125.1 (943.8)   65584.2 (43488.6)   1106365.5 (985975.1)
+// SIMD scan        15.0 (19.5)     61.6  (87.2)    3854.4  (4470.2)    150000.1 (292884.9)
+// std::set         24.1 (25.4)     96.9  (85.0)     232.5   (293.5)      1844.0   (1797.6)
+// binary search    10.4 (10.2)     20.5  (23.5)      45.3    (65.1)       111.0    (186.7)
+// std::binary_s.   35.7 (31.1)     89.6  (91.8)     147.7   (176.4)       273.3    (357.4)
+// Without -march=native (SSE2 only) the SIMD scan is 2 to 3 times slower, still 3 times faster than the linear scan.
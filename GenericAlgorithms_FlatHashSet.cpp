@@ -0,0 +1,420 @@
+/* An open addressing hash set with SwissTable-style control bytes
+ *
+ * hashing, open addressing, SIMD, cache friendly, heterogeneous lookup, data structures, performance
+ *
+ * motivation: GenericAlgorithms.cpp
+ *
+ * `contains` of GenericAlgorithms.cpp scans the whole range for every query.
+ * For many queries against the same values a hash set answers in O(1), but
+ * std::unordered_set keeps every element in a node of its own: a lookup
+ * follows a pointer to the bucket and one per element in it, each probably a
+ * cache miss.
+ * `flat_hash_set` stores the elements themselves in one array (open
+ * addressing) and next to it one control byte per slot: empty, deleted, or
+ * the lowest 7 bits of the hash of the element in the slot (h2). The other
+ * bits of the hash (h1) select the slot where the search starts. A lookup
+ * loads the control bytes of 16 consecutive slots (a group) into one SSE2
+ * register and compares all of them with h2 at once; only slots whose control
+ * byte matches (with 1/128 probability for a wrong element) are compared with
+ * the key. If the group contains an empty slot, the key is not in the set,
+ * otherwise the search continues with the next group (quadratic probing over
+ * groups). So nearly all lookups touch one group of control bytes and one
+ * element. The first 15 control bytes are repeated behind the last slot, so
+ * a group never wraps around.
+ * The table has a power of two slots and grows by 2 when it is 7/8 full.
+ * Erasing marks a slot as deleted (a tombstone), so the searches for other
+ * elements still continue past it.
+ * Lookups are heterogeneous if hash and equality are transparent (have
+ * `is_transparent`): a set of std::string can be queried with a
+ * std::string_view or a char const* without constructing a std::string.
+ *
+ * compile using `g++ --std=c++20 -O3`
+ */
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <random>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+using namespace std;
+
+//---------------------------------------------------------------------------------GenericAlgorithms
+// GenericAlgorithms.cpp
+
+template <typename Iterator, typename T>
+auto contains(Iterator begin, Iterator end, T const & value) {
+    while (begin != end)
+        if (*begin++ == value)
+            return true;
+    return false;
+}
+
+auto contains(std::ranges::range auto const & r, auto const & x) {
+    return contains(std::begin(r), std::end(r), x);
+}
+
+//---------------------------------------------------------------------------------------------Group
+
+namespace control {
+    constexpr std::int8_t empty   = -128;  // 0b10000000
+    constexpr std::int8_t deleted = -2;    // 0b11111110
+    // full: 0b0hhhhhhh, the 7 bits h2 of the hash
+}
+
+// the control bytes of 16 consecutive slots
+struct Group {
+    static constexpr std::size_t width = 16;
+
+    explicit Group(std::int8_t const * controls) noexcept {
+#ifdef __SSE2__
+        bytes_ = _mm_loadu_si128(reinterpret_cast<__m128i const*>(controls));
+#else
+        std::memcpy(bytes_, controls, width);
+#endif
+    }
+
+    // bit i is set if slot i has control byte `c`
+    std::uint32_t match(std::int8_t const c) const noexcept {
+#ifdef __SSE2__
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes_, _mm_set1_epi8(c))));
+#else
+        auto mask = std::uint32_t{0};
+        for (auto i = std::size_t{0}; i < width; ++i) mask |= std::uint32_t{bytes_[i] == c} << i;
+        return mask;
+#endif
+    }
+
+    std::uint32_t matchEmpty() const noexcept { return match(control::empty); }
+
+    // empty and deleted have the highest bit set
+    std::uint32_t matchEmptyOrDeleted() const noexcept {
+#ifdef __SSE2__
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(bytes_));
+#else
+        auto mask = std::uint32_t{0};
+        for (auto i = std::size_t{0}; i < width; ++i) mask |= std::uint32_t{bytes_[i] < 0} << i;
+        return mask;
+#endif
+    }
+
+private:
+#ifdef __SSE2__
+    __m128i bytes_;
+#else
+    std::int8_t bytes_[width];
+#endif
+};
+
+//-------------------------------------------------------------------------------------flat_hash_set
+
+template <typename T, typename Hash = std::hash<T>, typename Equal = std::equal_to<T>>
+class flat_hash_set {
+public:
+    class iterator;
+
+    flat_hash_set() = default;
+    flat_hash_set(std::initializer_list<T> values) { for (auto const & v : values) insert(v); }
+    template <std::ranges::input_range R>
+    explicit flat_hash_set(R const & values) { for (auto const & v : values) insert(v); }
+
+    flat_hash_set(flat_hash_set const & other) { for (auto const & v : other) insert(v); }
+    flat_hash_set(flat_hash_set && other) noexcept { swap(other); }
+    flat_hash_set& operator=(flat_hash_set other) noexcept { swap(other); return *this; }
+    ~flat_hash_set() { destroy(); }
+
+    void swap(flat_hash_set & other) noexcept {
+        std::swap(controls_, other.controls_);
+        std::swap(slots_, other.slots_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(size_, other.size_);
+        std::swap(growthLeft_, other.growthLeft_);
+    }
+
+    auto size()     const noexcept { return size_; }
+    auto capacity() const noexcept { return capacity_; }
+    bool empty()    const noexcept { return size_ == 0; }
+
+    iterator begin() const noexcept { return iterator{this, 0}; }
+    iterator end()   const noexcept { return iterator{this, capacity_}; }
+
+    // heterogeneous if `Hash` and `Equal` are transparent
+    template <typename K>
+        requires std::same_as<K, T> || (requires { typename Hash::is_transparent; typename Equal::is_transparent; })
+    bool contains(K const & key) const noexcept { return find(key) != npos; }
+
+    bool insert(T value);
+
+    template <typename K>
+        requires std::same_as<K, T> || (requires { typename Hash::is_transparent; typename Equal::is_transparent; })
+    bool erase(K const & key);
+
+private:
+    static constexpr auto npos = ~std::size_t{0};
+
+    // the hashes of std::hash are often the value itself, mix the bits (the finalizer of MurmurHash3):
+    // a multiplication alone leaves the low bits depending on the low bits of the key only
+    template <typename K>
+    static std::uint64_t hash(K const & key) noexcept {
+        auto h = static_cast<std::uint64_t>(Hash{}(key));
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        return h ^ (h >> 33);
+    }
+    static std::size_t h1(std::uint64_t const h) noexcept { return static_cast<std::size_t>(h >> 7); }
+    static std::int8_t h2(std::uint64_t const h) noexcept { return static_cast<std::int8_t>(h & 0x7f); }  // not used by h1
+
+    template <typename K>
+    std::size_t find(K const & key) const noexcept;
+    std::size_t findInsertSlot(std::uint64_t h) const noexcept;
+    void setControl(std::size_t slot, std::int8_t c) noexcept;
+    void rehash(std::size_t newCapacity);
+    void destroy() noexcept;
+
+    static std::size_t maxLoad(std::size_t capacity) noexcept { return capacity - capacity / 8; }
+
+    std::int8_t* controls_ = nullptr;  // capacity_ + Group::width - 1 bytes
+    T* slots_ = nullptr;
+    std::size_t capacity_ = 0;
+    std::size_t size_ = 0;
+    std::size_t growthLeft_ = 0;  // until the next rehash, deleted slots count as used
+};
+
+template <typename T, typename Hash, typename Equal>
+class flat_hash_set<T, Hash, Equal>::iterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using reference = T const &;
+    using pointer = T const *;
+
+    iterator() = default;
+
+    T const & operator*() const noexcept { return set_->slots_[slot_]; }
+    T const * operator->() const noexcept { return set_->slots_ + slot_; }
+    iterator& operator++() noexcept { ++slot_; skipEmpty(); return *this; }
+    iterator operator++(int) noexcept { auto old = *this; ++*this; return old; }
+    bool operator==(iterator const & other) const noexcept { return slot_ == other.slot_; }
+
+private:
+    friend class flat_hash_set;
+    iterator(flat_hash_set const * set, std::size_t slot) noexcept : set_{set}, slot_{slot} { skipEmpty(); }
+    void skipEmpty() noexcept { while (slot_ < set_->capacity_ && set_->controls_[slot_] < 0) ++slot_; }
+
+    flat_hash_set const * set_ = nullptr;
+    std::size_t slot_ = 0;
+};
+
+template <typename T, typename Hash, typename Equal>
+template <typename K>
+std::size_t flat_hash_set<T, Hash, Equal>::find(K const & key) const noexcept {
+    if (capacity_ == 0) return npos;
+    auto const h = hash(key);
+    auto const mask = capacity_ - 1;
+    auto position = h1(h) & mask;
+    for (auto probe = std::size_t{1}; ; ++probe) {
+        auto const group = Group{controls_ + position};
+        for (auto candidates = group.match(h2(h)); candidates; candidates &= candidates - 1) {
+            auto const slot = (position + static_cast<std::size_t>(std::countr_zero(candidates))) & mask;
+            if (Equal{}(slots_[slot], key)) [[likely]] return slot;
+        }
+        if (group.matchEmpty()) return npos;  // it would have been inserted here
+        position = (position + probe * Group::width) & mask;
+    }
+}
+
+template <typename T, typename Hash, typename Equal>
+std::size_t flat_hash_set<T, Hash, Equal>::findInsertSlot(std::uint64_t const h) const noexcept {
+    auto const mask = capacity_ - 1;
+    auto position = h1(h) & mask;
+    for (auto probe = std::size_t{1}; ; ++probe) {
+        if (auto const free = Group{controls_ + position}.matchEmptyOrDeleted())
+            return (position + static_cast<std::size_t>(std::countr_zero(free))) & mask;
+        position = (position + probe * Group::width) & mask;
+    }
+}
+
+// the first Group::width - 1 control bytes are repeated behind the last slot
+template <typename T, typename Hash, typename Equal>
+void flat_hash_set<T, Hash, Equal>::setControl(std::size_t const slot, std::int8_t const c) noexcept {
+    controls_[slot] = c;
+    if (slot < Group::width - 1) controls_[capacity_ + slot] = c;
+}
+
+template <typename T, typename Hash, typename Equal>
+bool flat_hash_set<T, Hash, Equal>::insert(T value) {
+    if (find(value) != npos) return false;
+    if (growthLeft_ == 0) rehash(std::max<std::size_t>(Group::width, size_ + 1 > maxLoad(capacity_) / 2 ? capacity_ * 2 : capacity_));
+    auto const h = hash(value);
+    auto const slot = findInsertSlot(h);
+    growthLeft_ -= controls_[slot] == control::empty;  // reusing a deleted slot costs nothing
+    std::construct_at(slots_ + slot, std::move(value));
+    setControl(slot, h2(h));
+    ++size_;
+    return true;
+}
+
+template <typename T, typename Hash, typename Equal>
+template <typename K>
+    requires std::same_as<K, T> || (requires { typename Hash::is_transparent; typename Equal::is_transparent; })
+bool flat_hash_set<T, Hash, Equal>::erase(K const & key) {
+    auto const slot = find(key);
+    if (slot == npos) return false;
+    std::destroy_at(slots_ + slot);
+    setControl(slot, control::deleted);
+    --size_;
+    return true;
+}
+
+// also with the same capacity, to clean up deleted slots
+template <typename T, typename Hash, typename Equal>
+void flat_hash_set<T, Hash, Equal>::rehash(std::size_t const newCapacity) {
+    auto old = flat_hash_set{};
+    swap(old);
+    capacity_ = newCapacity;
+    controls_ = new std::int8_t[capacity_ + Group::width - 1];
+    std::fill_n(controls_, capacity_ + Group::width - 1, control::empty);
+    slots_ = std::allocator<T>{}.allocate(capacity_);
+    growthLeft_ = maxLoad(capacity_);
+    for (auto slot = std::size_t{0}; slot < old.capacity_; ++slot) {
+        if (old.controls_[slot] < 0) continue;
+        auto const h = hash(old.slots_[slot]);
+        auto const newSlot = findInsertSlot(h);
+        std::construct_at(slots_ + newSlot, std::move(old.slots_[slot]));
+        setControl(newSlot, h2(h));
+        --growthLeft_;
+        ++size_;
+    }
+}
+
+template <typename T, typename Hash, typename Equal>
+void flat_hash_set<T, Hash, Equal>::destroy() noexcept {
+    if (!controls_) return;
+    for (auto slot = std::size_t{0}; slot < capacity_; ++slot)
+        if (controls_[slot] >= 0) std::destroy_at(slots_ + slot);
+    std::allocator<T>{}.deallocate(slots_, capacity_);
+    delete[] controls_;
+    controls_ = nullptr;
+}
+
+// for GenericAlgorithms.cpp
+template <typename T, typename Hash, typename Equal, typename K>
+auto contains(flat_hash_set<T, Hash, Equal> const & set, K const & key) {
+    return set.contains(key);
+}
+
+// transparent, for heterogeneous lookup
+struct string_hash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view s) const noexcept { return std::hash<std::string_view>{}(s); }
+};
+
+//---------------------------------------------------------------------------------------------Try It
+
+template <typename F>
+void measure(char const * name, std::size_t size, std::size_t queries, F f) {
+    auto found = std::size_t{0};
+    auto const start = std::chrono::steady_clock::now();
+    for (auto q = std::size_t{0}; q < queries; ++q) found += f(q);
+    auto const ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  " << std::setw(15) << std::left << name << std::right << std::setw(9) << size
+              << std::setw(12) << std::fixed << std::setprecision(1) << ns / static_cast<double>(queries)
+              << " ns/query, " << found << " found\n";
+}
+
+// keys that differ only in their high bits, like aligned pointers, must not cluster
+void strided(int const shift) {
+    auto const start = std::chrono::steady_clock::now();
+    auto set = flat_hash_set<long>{};
+    for (auto i = 0L; i < 100'000; ++i) set.insert(i << shift);
+    auto count = 0;
+    for (auto i = 0L; i < 200'000; ++i) count += set.contains(i << shift);
+    auto const ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  keys i << " << std::setw(2) << shift << ": " << count << " found, "
+              << std::fixed << std::setprecision(1) << ms << " ms\n";
+}
+
+void benchmark() {
+    auto engine = std::mt19937{42};
+    for (auto const size : {std::size_t{16}, std::size_t{1'000}, std::size_t{100'000}, std::size_t{1'000'000}}) {
+        auto values = std::vector<int>(size);
+        auto any = std::uniform_int_distribution<int>{0, std::numeric_limits<int>::max()};
+        for (auto & v : values) v = any(engine);
+
+        auto queries = std::vector<int>(1 << 16);  // half of them hit
+        auto pick = std::uniform_int_distribution<std::size_t>{0, size - 1};
+        for (auto i = std::size_t{0}; i < queries.size(); ++i) queries[i] = i % 2 ? values[pick(engine)] : any(engine);
+        auto const query = [&](std::size_t q) { return queries[q % queries.size()]; };
+
+        auto const flat = flat_hash_set<int>(values);
+        auto const unordered = std::unordered_set<int>(values.begin(), values.end());
+        auto sorted = values;
+        std::ranges::sort(sorted);
+        auto const numLookups = std::size_t{1} << 22;
+
+        measure("linear scan", size, std::max<std::size_t>(16, (std::size_t{1} << 26) / size),
+                [&](std::size_t q) { return contains(values, query(q)); });
+        measure("binary search", size, numLookups, [&](std::size_t q) { return std::ranges::binary_search(sorted, query(q)); });
+        measure("unordered_set", size, numLookups, [&](std::size_t q) { return unordered.contains(query(q)); });
+        measure("flat_hash_set", size, numLookups, [&](std::size_t q) { return contains(flat, query(q)); });
+    }
+}
+
+int main() {
+    auto s = flat_hash_set<int>{1, 2, 3};
+    cout << boolalpha << contains(s, 1) << ' ' << contains(s, -1) << '\n';  // true false
+    s.erase(1);
+    s.insert(4);
+    cout << contains(s, 1) << ' ' << contains(s, 4) << ' ' << s.size() << '\n';  // false true 3
+
+    // heterogeneous lookup: no std::string is constructed for the query
+    auto const words = flat_hash_set<std::string, string_hash, std::equal_to<>>{"alpha", "beta", "gamma"};
+    cout << contains(words, std::string_view{"beta"}) << ' ' << contains(words, "delta") << '\n';  // true false
+
+    // grows, erases and reuses deleted slots
+    auto many = flat_hash_set<int>{};
+    for (auto i = 0; i < 100'000; ++i) many.insert(i);
+    for (auto i = 0; i < 100'000; i += 2) many.erase(i);
+    for (auto i = 0; i < 100'000; i += 4) many.insert(i);
+    auto count = 0;
+    for (auto i = 0; i < 100'000; ++i) count += many.contains(i);
+    cout << count << ' ' << many.size() << ' ' << std::ranges::distance(many) << ' ' << many.capacity() << '\n';  // 75000 75000 75000 131072
+
+    // 100000 found each, in about the same time
+    strided(0);
+    strided(24);
+    strided(32);
+
+    benchmark();
+}
+
+// ns per query, half of them hit, int, -O3 (-O0):
+//                      16                1'000              100'000             1'000'000
+// linear scan     18.8 (216.2)    548.2  (9703.0)   51688.4 (978085.7)   407602.0  (6763166.2)
+// binary search   34.3 (324.9)     99.5   (678.3)     163.6   (1199.0)      272.0     (1631.2)
+// unordered_set   19.3 (130.3)     21.1   (142.8)      36.4    (575.6)      100.5      (590.8)
+// flat_hash_set    8.9  (80.9)      8.2    (84.2)      14.4     (95.2)       55.0      (218.0)
+// With a single multiplication as hash the flat_hash_set took 24 ns at 1'000'000 for these random
+// keys, but keys like i << 24 all started at the same group: 100'000 inserts took seconds instead
+// of the 7 ms they take now.
@@ -0,0 +1,267 @@
+/* Type-indexed event bus as alternative to inheriting multiple SubjectI<State>
+ *
+ * design pattern, observer, one-to-many, publish-subscribe, type erasure, templates
+ *
+ * Observer2.cpp lets one `Subject` publish several `State` types by inheriting
+ * `SubjectI<State>` once per type. Each type requires its own `Tag`, its own
+ * vector of observers and its own hand-written set of functions. This does
+ * not scale past a handful of types.
+ * The `EventBus` below is keyed by the event type instead. Every event type
+ * gets a dense integer id the first time it is used (`EventId<Event>::value`).
+ * The id is an index into a vector of channels, one channel per event type,
+ * holding the `ObserverI<Event>*` subscribers. Publishing therefore costs one
+ * load of a static and one index operation, there is no hashing (like with a
+ * map keyed by `std::type_index`) and no allocation.
+ * Events are passed on by reference (`publish`). Alternatively, they can be
+ * moved into a per-type queue (`enqueue`) and delivered later (`dispatch`).
+ * Only the channels with pending events are visited by `dispatch`.
+ *
+ * compile using `g++ --std=c++20 -O3`
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+using namespace std;
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+//----------------------------------------------------------------------------------------Interfaces
+
+template <typename State>
+struct ObserverI {
+    virtual void notify(State const &) = 0;
+};
+
+//-------------------------------------------------------------------------------------------EventId
+// Hands out 0, 1, 2, ... in the order in which event types are first used.
+
+inline std::size_t nextEventId() noexcept {
+    static std::size_t nextId = 0;
+    return nextId++;
+}
+
+template <typename Event>
+struct EventId {
+    static inline std::size_t const value = nextEventId();
+};
+
+//------------------------------------------------------------------------------------------EventBus
+
+class EventBus {
+public:
+    template <typename Event>
+    void subscribe(ObserverI<Event>* observer) { channel<Event>().observers.push_back(observer); }
+
+    template <typename Event>
+    void unsubscribe(ObserverI<Event>* observer) {
+        auto & observers = channel<Event>().observers;
+        observers.erase(remove(begin(observers), end(observers), observer), cend(observers));
+    }
+
+    // deliver immediately, the event is passed on by reference
+    template <typename Event>
+    void publish(Event const & event) const {
+        auto const id = EventId<Event>::value;
+        if (id >= channels_.size() || !channels_[id]) return;  // nobody ever subscribed
+        for (auto* observer : static_cast<Channel<Event> const &>(*channels_[id]).observers)
+            observer->notify(event);
+    }
+
+    // queued mode: move the event into the bus and deliver it on `dispatch`
+    template <typename Event>
+    void enqueue(Event && event) {
+        using E = std::remove_cvref_t<Event>;
+        auto & ch = channel<E>();
+        if (ch.queue.empty()) pending_.push_back(EventId<E>::value);
+        ch.queue.push_back(std::forward<Event>(event));
+    }
+
+    // events enqueued by the observers meanwhile are delivered by the next `dispatch`
+    void dispatch() {
+        std::swap(pending_, dispatching_);
+        for (auto const id : dispatching_) channels_[id]->takeQueued();
+        for (auto const id : dispatching_) channels_[id]->deliverQueued();
+        dispatching_.clear();
+    }
+
+private:
+    struct ChannelBase {
+        virtual ~ChannelBase() = default;
+        virtual void takeQueued() = 0;
+        virtual void deliverQueued() = 0;
+    };
+
+    template <typename Event>
+    struct Channel : ChannelBase {
+        void takeQueued() override { std::swap(queue, delivering); }  // an observer may enqueue into `queue`
+        void deliverQueued() override {
+            for (auto const & event : delivering)
+                for (auto* observer : observers) observer->notify(event);
+            delivering.clear();  // keeps the capacity, later enqueues don't allocate
+        }
+        vector<ObserverI<Event>*> observers;
+        vector<Event> queue;
+        vector<Event> delivering;
+    };
+
+    // creates the channel on first use, i.e. on subscribing, never on publishing
+    template <typename Event>
+    auto channel() -> Channel<Event> & {
+        auto const id = EventId<Event>::value;
+        if (id >= channels_.size()) channels_.resize(id + 1);
+        if (!channels_[id]) channels_[id] = make_unique<Channel<Event>>();
+        return static_cast<Channel<Event>&>(*channels_[id]);
+    }
+
+    vector<unique_ptr<ChannelBase>> channels_;
+    vector<std::size_t> pending_;
+    vector<std::size_t> dispatching_;
+};
+
+//-------------------------------------------------------------------------------------------Example
+// the observers from Observer2.cpp work unchanged
+
+using StateInt = int;
+using StateString = string;
+
+struct IntObserver : ObserverI<StateInt> {
+    // ObserverI<StateInt>
+    void notify(StateInt const & state) override {
+        cout << "int observer observed state: " << state << endl; }
+};
+
+struct StringObserver : ObserverI<StateString> {
+    // ObserverI<StateString>
+    void notify(StateString const & state) override {
+        cout << "string observer observed state: " << state << endl; }
+};
+
+// no casts or tags needed, the event type selects the right base
+struct AllObserver : ObserverI<StateInt>,
+                     ObserverI<StateString> {
+    // ObserverI<StateString>
+    void notify(StateString const & state) override {
+        cout << "all observer observed state: " << state << endl; }
+    // ObserverI<StateInt>
+    void notify(StateInt const & state) override {
+        cout << "all observer observed state: " << state << endl; }
+};
+
+// reacts to an event by posting another one
+struct Forwarder : ObserverI<StateInt> {
+    explicit Forwarder(EventBus & bus) : bus_{bus} {}
+    // ObserverI<StateInt>
+    void notify(StateInt const & state) override {
+        for (auto i = 0; i < 100; ++i) bus_.enqueue(StateInt{state + 1});  // reallocates the queue
+        bus_.enqueue(StateString{"forwarded " + to_string(state)});
+    }
+private:
+    EventBus & bus_;
+};
+
+//--------------------------------------------------------------------------many event types
+
+template <int N>
+struct Tick { long long value; };
+
+template <int N>
+struct TickCounter : ObserverI<Tick<N>> {
+    void notify(Tick<N> const & tick) override { sum += tick.value; }
+    long long sum = 0;
+};
+
+template <int N>
+TickCounter<N> tickCounter;
+
+constexpr auto numEventTypes = 256;
+
+template <int... Ns>
+auto publishAllTicks(EventBus const & bus, long long value, std::integer_sequence<int, Ns...>) {
+    (bus.publish(Tick<Ns>{value}), ...);
+}
+
+template <int... Ns>
+auto benchmarkManyEventTypes(std::integer_sequence<int, Ns...> types) {
+    EventBus bus;
+    (bus.subscribe<Tick<Ns>>(&tickCounter<Ns>), ...);
+
+    constexpr auto rounds = 10'000;
+    {
+        ScopedTimer t{"publish 256 event types x 10000 rounds"};  // 349334us, -O3: 51959us
+        for (auto i = 0; i < rounds; ++i)
+            publishAllTicks(bus, i, types);
+    }
+    return (tickCounter<Ns>.sum + ...);
+}
+
+//--------------------------------------------------------------------------------------------Try It
+
+int main() {
+    EventBus bus;
+    IntObserver    intObserver;
+    StringObserver stringObserver;
+    AllObserver    allObserver;
+
+    bus.subscribe<StateInt>(&intObserver);
+    bus.subscribe<StateString>(&stringObserver);
+    bus.subscribe<StateInt>(&allObserver);
+    bus.subscribe<StateString>(&allObserver);
+
+    bus.publish(StateInt{42});
+    bus.publish(StateString{"Hello World"});
+    bus.publish(3.14);  // no subscribers, nothing happens
+
+    bus.unsubscribe<StateInt>(&allObserver);
+    bus.enqueue(StateString{"queued string"});
+    bus.enqueue(StateInt{7});
+    cout << "-- dispatch queued events\n";
+    bus.dispatch();
+
+    // observers enqueueing while the bus dispatches
+    EventBus chain;
+    Forwarder forwarder{chain};
+    chain.subscribe<StateInt>(&forwarder);
+    chain.subscribe<StateString>(&stringObserver);
+    chain.enqueue(StateInt{1});
+    cout << "-- dispatch 1\n";
+    chain.dispatch();  // 1 int -> 100 ints and "forwarded 1", nothing printed
+    cout << "-- dispatch 2\n";
+    chain.dispatch();  // "forwarded 1"; 100 ints -> 10000 ints and 100 x "forwarded 2"
+    chain.unsubscribe<StateInt>(&forwarder);
+    cout << "-- dispatch 3\n";
+    chain.dispatch();  // 100 x "forwarded 2"
+
+    cout << '\n' << benchmarkManyEventTypes(std::make_integer_sequence<int, numEventTypes>{}) << '\n';
+}
@@ -0,0 +1,276 @@
+/* Observer pattern with O(1) unregistering via generational handles
+ *
+ * design pattern, observer, one-to-many, slot map, generational index, data structures
+ *
+ * `Subject::unregister` in Observer.cpp (and Observer2.cpp) searches the
+ * vector of observers for the pointer to remove, which is O(n). Unregistering
+ * an observer twice, or one that was never registered, silently does nothing.
+ * A slot map fixes both. Registering returns a `Handle` consisting of a slot
+ * index and a generation. The slot stores where the observer currently lives
+ * in a dense array. Erasing moves the last element of the dense array into the
+ * gap (swap-and-pop) and increments the slot's generation, so every handle
+ * that still refers to the old generation is detected as stale. Freed slots
+ * are kept in a free list and reused. Generations start at 1, so a
+ * value-initialized `Handle{}` (generation 0) never refers to an observer.
+ * A slot whose generation would wrap around is retired instead of reused:
+ * after 2^32 - 1 erasures, a wrapped generation could match an ancient handle.
+ * Notifying still iterates over a dense array of observers, but note that the
+ * order of the observers changes when one of them is erased.
+ *
+ * compile using `g++ --std=c++20 -O3`
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+using namespace std;
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+//-------------------------------------------------------------------------------------------SlotMap
+
+struct Handle {
+    std::uint32_t index = 0;
+    std::uint32_t generation = 0;  // 0: never valid
+};
+
+template <typename T>
+class SlotMap {
+public:
+    auto insert(T value) -> Handle;
+    auto erase(Handle handle) -> bool;  // false if the handle is stale
+
+    auto contains(Handle handle) const noexcept -> bool {
+        return handle.generation != retired && handle.index < slots_.size()
+            && slots_[handle.index].generation == handle.generation;
+    }
+    auto get(Handle handle) noexcept -> T* {
+        return contains(handle) ? &dense_[slots_[handle.index].denseIndex] : nullptr;
+    }
+
+    auto size() const noexcept { return dense_.size(); }
+    auto begin()       noexcept { return dense_.begin(); }
+    auto end()         noexcept { return dense_.end(); }
+    auto begin() const noexcept { return dense_.begin(); }
+    auto end()   const noexcept { return dense_.end(); }
+
+private:
+    struct Slot {
+        std::uint32_t denseIndex;  // if occupied: index into dense_, else: next free slot
+        std::uint32_t generation;
+    };
+    static constexpr std::uint32_t noFreeSlot = UINT32_MAX;
+    static constexpr std::uint32_t retired = 0;  // generation of slots that are never reused
+
+    vector<T> dense_;
+    vector<std::uint32_t> denseToSlot_;  // inverse of Slot::denseIndex, needed for swap-and-pop
+    vector<Slot> slots_;
+    std::uint32_t freeHead_ = noFreeSlot;
+};
+
+template <typename T>
+auto SlotMap<T>::insert(T value) -> Handle {
+    auto slotIndex = freeHead_;
+    if (slotIndex == noFreeSlot) {
+        slotIndex = static_cast<std::uint32_t>(slots_.size());
+        slots_.push_back(Slot{0, 1});
+    }
+    else freeHead_ = slots_[slotIndex].denseIndex;
+
+    auto & slot = slots_[slotIndex];
+    slot.denseIndex = static_cast<std::uint32_t>(dense_.size());
+    dense_.push_back(std::move(value));
+    denseToSlot_.push_back(slotIndex);
+    return Handle{slotIndex, slot.generation};
+}
+
+template <typename T>
+auto SlotMap<T>::erase(Handle handle) -> bool {
+    if (!contains(handle)) return false;
+
+    auto & slot = slots_[handle.index];
+    auto const gap = slot.denseIndex;
+    auto const last = static_cast<std::uint32_t>(dense_.size() - 1);
+    if (gap != last) {  // swap-and-pop
+        dense_[gap] = std::move(dense_[last]);
+        denseToSlot_[gap] = denseToSlot_[last];
+        slots_[denseToSlot_[gap]].denseIndex = gap;
+    }
+    dense_.pop_back();
+    denseToSlot_.pop_back();
+
+    if (slot.generation == UINT32_MAX) {  // costs 8 bytes per 2^32 erasures
+        slot.generation = retired;
+        return true;
+    }
+    ++slot.generation;  // invalidates all outstanding handles to this slot
+    slot.denseIndex = freeHead_;
+    freeHead_ = handle.index;
+    return true;
+}
+
+//----------------------------------------------------------------------------------------Interfaces
+
+template <typename State>
+struct ObserverI {
+    virtual void notify(State const &) = 0;
+};
+
+template <typename State>
+struct SubjectI {
+    using Subscription = Handle;
+
+    virtual auto doregister(ObserverI<State>*) -> Subscription = 0;
+    virtual auto unregister(Subscription) -> bool = 0;  // false if already unregistered
+    virtual void notifyObservers() const = 0;
+};
+
+//-------------------------------------------------------------------------------------------Example
+
+using State = int;
+
+class Subject : public SubjectI<State> {
+public:
+    void setState(State newState) noexcept { state_ = newState; }
+    auto numObservers() const noexcept { return observers_.size(); }
+
+    // SubjectI
+    auto doregister(ObserverI<State>* newObserver) -> Subscription override {
+        return observers_.insert(newObserver);
+    }
+
+    auto unregister(Subscription subscription) -> bool override {
+        return observers_.erase(subscription);
+    }
+
+    void notifyObservers() const override {
+        for (auto & observer : observers_) observer->notify(state_);
+    }
+
+private:
+    State state_{-1};
+    SlotMap<ObserverI<State>*> observers_;
+};
+
+// as in Observer.cpp, for comparison
+class VectorSubject {
+public:
+    void setState(State newState) noexcept { state_ = newState; }
+
+    void doregister(ObserverI<State>* newObserver) { observers_.push_back(newObserver); }
+
+    void unregister(ObserverI<State>* observer) {
+        observers_.erase(std::remove(std::begin(observers_), std::end(observers_), observer),
+                        std::cend(observers_));
+    }
+
+    void notifyObservers() const {
+        for (auto & observer : observers_) observer->notify(state_);
+    }
+
+private:
+    State state_{-1};
+    std::vector<ObserverI<State>*> observers_;
+};
+
+struct Observer : ObserverI<State> {
+    // ObserverI
+    void notify(State const & state) override { sum += state; }
+    long long sum = 0;
+};
+
+struct PrintingObserver : ObserverI<State> {
+    // ObserverI
+    void notify(State const & state) override {
+        std::cout << "printing observer observed state: " << state << '\n';
+    }
+};
+
+//--------------------------------------------------------------------------------------------Try It
+
+int main() {
+    {
+        Subject subject;
+        PrintingObserver observer1, observer2;
+        auto const subscription1 = subject.doregister(&observer1);
+        subject.doregister(&observer2);
+        subject.notifyObservers();
+
+        cout << boolalpha;
+        cout << "unregister Handle{}: " << subject.unregister(Handle{}) << '\n';  // false, never valid
+        cout << "unregister: "       << subject.unregister(subscription1) << '\n';  // true
+        cout << "unregister again: " << subject.unregister(subscription1) << '\n';  // false, stale
+        subject.doregister(&observer1);  // reuses the slot with a new generation
+        cout << "unregister stale: " << subject.unregister(subscription1) << '\n';  // false, stale
+        subject.setState(42);
+        subject.notifyObservers();
+    }
+
+    // Churn: 20000 subscribers, repeatedly unregister a random one and register a new one.
+    constexpr auto numObservers = 20'000;
+    constexpr auto numChurns = 20'000;
+    auto observers = vector<Observer>(numObservers + numChurns);
+    auto rng = std::mt19937{42};
+    {
+        auto subject = Subject{};
+        auto subscriptions = vector<Handle>{};
+        for (auto i = 0; i < numObservers; ++i)
+            subscriptions.push_back(subject.doregister(&observers[i]));
+        {
+            ScopedTimer t{"churn slot map"};  // 3246us, -O3: 479us
+            for (auto i = 0; i < numChurns; ++i) {
+                auto & victim = subscriptions[rng() % subscriptions.size()];
+                subject.unregister(victim);
+                victim = subject.doregister(&observers[numObservers + i]);
+            }
+        }
+        subject.notifyObservers();
+        cout << subject.numObservers() << " observers\n";
+    }
+    {
+        auto subject = VectorSubject{};
+        auto registered = vector<Observer*>{};
+        for (auto i = 0; i < numObservers; ++i) {
+            subject.doregister(&observers[i]);
+            registered.push_back(&observers[i]);
+        }
+        {
+            ScopedTimer t{"churn vector"};    // 6382301us, -O3: 313130us
+            for (auto i = 0; i < numChurns; ++i) {
+                auto & victim = registered[rng() % registered.size()];
+                subject.unregister(victim);
+                victim = &observers[numObservers + i];
+                subject.doregister(victim);
+            }
+        }
+        subject.notifyObservers();
+    }
+}
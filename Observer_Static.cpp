@@ -0,0 +1,207 @@
+/* Observer pattern with an observer set that is known at compile time
+ *
+ * design pattern, observer, one-to-many, static polymorphism, variadic templates, fold expressions
+ *
+ * In Observer.cpp every notification is a virtual call through a raw pointer
+ * stored in a vector. The compiler cannot inline these calls, because it does
+ * not know which `notify` it will end up in.
+ * If we know the types of all observers at compile time, we can store
+ * references to them in a `std::tuple` and notify them via a fold expression
+ * over the tuple's elements. Every call is now a direct call that can be
+ * inlined. The price is that observers can no longer be (un-)registered at
+ * runtime: the set of observers is fixed upon construction.
+ * `static_subject` offers the same `setState` / `notifyObservers` interface as
+ * `Subject`, so generic code can use both (see `run`). Observers don't have to
+ * implement `ObserverI`; they only need a suitable `notify`. If they do
+ * implement `ObserverI`, marking them `final` lets the compiler devirtualize
+ * the call anyway.
+ *
+ * compile using `g++ --std=c++20 -O3`
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+using namespace std;
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+//----------------------------------------------------------------------------------------Interfaces
+
+template <typename State>
+struct ObserverI {
+    virtual void notify(State const &) = 0;
+};
+
+template <typename State>
+struct SubjectI {
+    virtual void doregister(ObserverI<State>*) = 0;
+    virtual void unregister(ObserverI<State>*) = 0;
+    virtual void notifyObservers() const = 0;
+};
+
+//--------------------------------------------------------------------------------dynamic observers
+// as in Observer.cpp
+
+using State = int;
+
+class Subject : public SubjectI<State> {
+public:
+    void setState(State newState) noexcept { state_ = newState; }
+
+    // SubjectI
+    void doregister(ObserverI<State>* newObserver) override {
+        observers_.push_back(newObserver);
+    }
+
+    void unregister(ObserverI<State>* observer) override {
+        observers_.erase(std::remove(std::begin(observers_), std::end(observers_), observer),
+                        std::cend(observers_));
+    }
+
+    void notifyObservers() const override {
+        for (auto & observer : observers_) observer->notify(state_);
+    }
+
+private:
+    State state_{-1};
+    std::vector<ObserverI<State>*> observers_;
+};
+
+//---------------------------------------------------------------------------------static observers
+
+template <typename T, typename State>
+concept StaticObserver = requires (T & observer, State const & state) {
+    observer.notify(state);
+};
+
+template <typename State, StaticObserver<State>... Observers>
+class static_subject {
+public:
+    explicit static_subject(Observers&... observers) noexcept : observers_{observers...} {}
+
+    void setState(State newState) noexcept { state_ = std::move(newState); }
+
+    void notifyObservers() const {
+        std::apply([this](auto&... observer) { (observer.notify(state_), ...); }, observers_);
+    }
+
+private:
+    State state_{};
+    std::tuple<Observers&...> observers_;
+};
+
+// the observers are deduced, the state is not: make_static_subject<State>(o1, o2)
+template <typename State, StaticObserver<State>... Observers>
+auto make_static_subject(Observers&... observers) noexcept {
+    return static_subject<State, Observers...>{observers...};
+}
+
+//-------------------------------------------------------------------------------------------Example
+
+struct PrintingObserver {  // no common base required
+    void notify(State const & state) const {
+        std::cout << "printing observer observed state: " << state << '\n';
+    }
+};
+
+struct VerboseObserver final : ObserverI<State> {
+    // ObserverI
+    void notify(State const & state) override {
+        std::cout << "Hi there, I just got notified of the state: " << state
+                  << ". Well have a nice day!" << '\n';
+    }
+};
+
+struct CountingObserver final : ObserverI<State> {
+    // ObserverI
+    void notify(State const & state) override { sum += state; }
+    long long sum = 0;
+};
+
+// works for both, `Subject` and `static_subject`
+template <typename AnySubject>
+void run(AnySubject & subject, std::vector<State> const & states) {
+    for (auto const state : states) {
+        subject.setState(state);
+        subject.notifyObservers();
+    }
+}
+
+// states the compiler cannot know, with the constant 0, 1, 2, ... it folds the static loop into a formula
+auto randomStates(std::size_t const n) {
+    auto states = std::vector<State>(n);
+    auto engine = std::mt19937{42};
+    auto distribution = std::uniform_int_distribution<State>{-1000, 1000};
+    for (auto & state : states) state = distribution(engine);
+    return states;
+}
+
+//--------------------------------------------------------------------------------------------Try It
+
+int main() {
+    {
+        PrintingObserver printingObserver;
+        VerboseObserver verboseObserver;
+        auto subject = make_static_subject<State>(printingObserver, verboseObserver);
+        subject.setState(-1);
+        subject.notifyObservers();
+        subject.setState(42);
+        subject.notifyObservers();
+    }
+
+    constexpr auto numNotifications = 10'000'000;
+    auto const states = randomStates(numNotifications);
+    cout << '\n' << numNotifications << " notifications of three observers:\n";
+    {
+        CountingObserver o1, o2, o3;
+        Subject subject;
+        subject.doregister(&o1);
+        subject.doregister(&o2);
+        subject.doregister(&o3);
+        {
+            ScopedTimer t{"virtual Subject"};  // 559785us, -O3: 59833us
+            run(subject, states);
+        }
+        cout << o1.sum + o2.sum + o3.sum << '\n';
+    }
+    {
+        CountingObserver o1, o2, o3;
+        auto subject = make_static_subject<State>(o1, o2, o3);
+        {
+            ScopedTimer t{"static_subject"};   // 759884us, -O3:  6976us (inlined and vectorized)
+            run(subject, states);
+        }
+        cout << o1.sum + o2.sum + o3.sum << '\n';
+    }
+}
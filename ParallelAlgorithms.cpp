@@ -0,0 +1,298 @@
+/* parallel_for, parallel_reduce and parallel_transform_reduce on a fork-join pool
+ *
+ * concurrency, parallel, algorithms, fork-join, thread pool, reduction
+ *
+ * motivation: C++ High Performance
+ *
+ * The kernels of PerformanceMemoryLayout1.cpp (`fast`), PerformanceMemoryLayout2.cpp
+ * (`sum_scores`), GenericAlgorithms.cpp (`contains`) and Ranges01.cpp
+ * (`get_max_x`) all run on a single thread. Here we run them on all cores.
+ * The index range is cut into chunks of `grain` elements. The threads of a
+ * `ForkJoinPool` (the calling thread included) grab chunks via an atomic
+ * counter until none are left, so faster threads simply process more chunks.
+ * The grain size trades scheduling overhead (too small) against load
+ * imbalance (too large).
+ * Reductions are deterministic: every chunk is reduced into its own slot and
+ * the slots are combined in order on the calling thread. Since the chunks do
+ * not depend on the number of threads, the result is the same for any number
+ * of threads, even for non-associative operations like floating point
+ * addition. For this to work, `init` has to be the identity of the reduction
+ * (it is used as starting value of every chunk).
+ * `contains` stops early: chunks that start after the value was found return
+ * immediately.
+ * std::reduce with std::execution::par would do similar things, but gives no
+ * control over the grain size and no determinism guarantees (and requires TBB
+ * with libstdc++).
+ *
+ * compile using `g++ --std=c++20 -O3 -pthread`
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <ranges>
+#include <thread>
+#include <type_traits>
+#include <vector>
+using namespace std;
+
+//--------------------------------------------------------------------------------------ForkJoinPool
+
+class ForkJoinPool {
+public:
+    explicit ForkJoinPool(unsigned numThreads);  // including the calling thread
+    ~ForkJoinPool();
+
+    ForkJoinPool(ForkJoinPool const &)            = delete;
+    ForkJoinPool& operator=(ForkJoinPool const &) = delete;
+
+    // calls `chunk(i)` for every i in [0, numChunks) and returns when all are done
+    template <typename F>
+    void run(std::size_t numChunks, F&& chunk);
+
+    auto size() const noexcept { return helpers_.size() + 1; }
+
+private:
+    struct Job {
+        void (*invoke)(void* chunk, std::size_t i);
+        void* chunk;
+        std::size_t numChunks;
+        std::atomic<std::size_t> next{0};
+        std::atomic<std::size_t> unfinished;
+        std::exception_ptr exception;
+        std::atomic_flag failed;
+    };
+
+    void work(Job & job);
+    void helperLoop();
+
+    std::vector<std::thread> helpers_;
+    std::mutex mutex_;
+    std::condition_variable started_;
+    std::condition_variable finished_;
+    Job* job_ = nullptr;
+    std::size_t generation_ = 0;
+    std::size_t active_ = 0;  // helpers working on `job_`, it has to stay alive until they are done
+    bool stop_ = false;
+};
+
+ForkJoinPool::ForkJoinPool(unsigned numThreads) {
+    for (auto i = 1u; i < numThreads; ++i)
+        helpers_.emplace_back([this] { helperLoop(); });
+}
+
+ForkJoinPool::~ForkJoinPool() {
+    {
+        auto lock = std::scoped_lock{mutex_};
+        stop_ = true;
+    }
+    started_.notify_all();
+    for (auto & helper : helpers_) helper.join();
+}
+
+template <typename F>
+void ForkJoinPool::run(std::size_t numChunks, F&& chunk) {
+    auto job = Job{};
+    job.invoke = [](void* f, std::size_t i) { (*static_cast<std::remove_reference_t<F>*>(f))(i); };
+    job.chunk = &chunk;
+    job.numChunks = numChunks;
+    job.unfinished = numChunks;
+    {
+        auto lock = std::scoped_lock{mutex_};
+        job_ = &job;
+        ++generation_;
+    }
+    started_.notify_all();
+    work(job);
+    {
+        auto lock = std::unique_lock{mutex_};
+        finished_.wait(lock, [&] { return job.unfinished == 0 && active_ == 0; });
+        job_ = nullptr;
+    }
+    if (job.exception) std::rethrow_exception(job.exception);
+}
+
+void ForkJoinPool::work(Job & job) {
+    for (auto i = job.next++; i < job.numChunks; i = job.next++) {
+        try { job.invoke(job.chunk, i); }
+        catch (...) { if (!job.failed.test_and_set()) job.exception = std::current_exception(); }
+        job.unfinished.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void ForkJoinPool::helperLoop() {
+    auto seen = std::size_t{0};
+    while (true) {
+        auto lock = std::unique_lock{mutex_};
+        started_.wait(lock, [&] { return stop_ || (job_ && generation_ != seen); });
+        if (stop_) return;
+        seen = generation_;
+        auto & job = *job_;
+        ++active_;
+        lock.unlock();
+
+        work(job);
+
+        lock.lock();
+        --active_;
+        lock.unlock();
+        finished_.notify_one();
+    }
+}
+
+//-----------------------------------------------------------------------------------------Algorithms
+
+constexpr std::size_t defaultGrain = 16 * 1024;
+
+// calls `body(first, last)` for consecutive sub-ranges of [0, n) with at most `grain` elements
+template <typename Body>
+void parallel_for(ForkJoinPool & pool, std::size_t n, Body body, std::size_t grain = defaultGrain) {
+    auto const numChunks = (n + grain - 1) / grain;
+    pool.run(numChunks, [&](std::size_t chunk) {
+        auto const first = chunk * grain;
+        body(first, std::min(n, first + grain));
+    });
+}
+
+template <std::ranges::random_access_range R, typename T, typename Reduce, typename Transform>
+auto parallel_transform_reduce(ForkJoinPool & pool, R && range, T init, Reduce reduce, Transform transform,
+                               std::size_t grain = defaultGrain) -> T {
+    auto const n = static_cast<std::size_t>(std::ranges::size(range));
+    auto const first = std::ranges::begin(range);
+    auto partials = std::vector<T>((n + grain - 1) / grain, init);
+
+    parallel_for(pool, n, [&](std::size_t lo, std::size_t hi) {
+        auto sum = init;
+        for (auto i = lo; i < hi; ++i)
+            sum = reduce(std::move(sum), std::invoke(transform, first[i]));
+        partials[lo / grain] = std::move(sum);
+    }, grain);
+
+    return std::accumulate(std::begin(partials), std::end(partials), init, reduce);  // in order
+}
+
+template <std::ranges::random_access_range R, typename T, typename Reduce>
+auto parallel_reduce(ForkJoinPool & pool, R && range, T init, Reduce reduce,
+                     std::size_t grain = defaultGrain) -> T {
+    return parallel_transform_reduce(pool, std::forward<R>(range), std::move(init), reduce, std::identity{}, grain);
+}
+
+//-------------------------------------------------------------------------------------------Kernels
+
+// PerformanceMemoryLayout1.cpp: sum up a matrix row by row
+constexpr std::size_t numRows = 4096;
+using Matrix = vector<int>;  // numRows x numRows, row major
+
+auto fast(ForkJoinPool & pool, Matrix const & m) {
+    return parallel_transform_reduce(pool, views::iota(std::size_t{0}, numRows), 0ll, std::plus<>{},
+        [&](std::size_t row) {
+            auto const first = std::begin(m) + row * numRows;
+            return std::accumulate(first, first + numRows, 0ll); },
+        16);  // rows per chunk
+}
+
+// PerformanceMemoryLayout2.cpp
+struct Small {
+    array<char,4> data{};
+    int score{rand()};
+};
+
+auto sum_scores(ForkJoinPool & pool, vector<Small> const & arr) {
+    return parallel_transform_reduce(pool, arr, 0ll, std::plus<>{}, &Small::score);
+}
+
+// GenericAlgorithms.cpp
+template <typename T>
+auto contains(ForkJoinPool & pool, vector<T> const & v, T const & value) {
+    auto found = std::atomic<bool>{false};
+    parallel_for(pool, v.size(), [&](std::size_t lo, std::size_t hi) {
+        if (found.load(std::memory_order_relaxed)) return;  // somebody else was faster
+        if (std::find(std::begin(v) + lo, std::begin(v) + hi, value) != std::begin(v) + hi)
+            found.store(true, std::memory_order_relaxed);
+    });
+    return found.load();
+}
+
+// Ranges01.cpp
+struct Point {
+    int x, y;
+    double time;
+};
+
+auto get_max_x(ForkJoinPool & pool, vector<Point> const & points) {
+    auto const in_time = [](auto&& p){ return 2.0 <= p.time && p.time <= 3.0; };
+    auto const max = [](std::optional<int> a, std::optional<int> b) {
+        return !a ? b : !b ? a : std::optional{std::max(*a, *b)}; };
+    auto const x_in_time = [&](Point const & p) { return in_time(p) ? std::optional{p.x} : std::nullopt; };
+    return parallel_transform_reduce(pool, points, std::optional<int>{}, max, x_in_time).value_or(0);
+}
+
+// the sequential version from Ranges01.cpp, for comparison
+auto get_max_x(vector<Point> const & points) {
+    auto const in_time = [](auto&& p){ return 2.0 <= p.time && p.time <= 3.0; };
+    auto range = points | std::views::filter(in_time) | std::views::transform(&Point::x);
+    const auto it = std::ranges::max_element(range);
+    return it != std::end(range) ? *it : 0;
+}
+
+//----------------------------------------------------------------------------------------------Misc
+// like ScopedTimer.cpp, but returns the duration instead of printing it
+
+template <typename F>
+auto measure_us(F&& f) {
+    using namespace std::chrono;
+    auto const start = steady_clock::now();
+    f();
+    return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+//--------------------------------------------------------------------------------------------Try It
+
+int main() {
+    auto const matrix = Matrix(numRows * numRows, 1);
+    auto const smalls = vector<Small>(10'000'000);
+    auto ints = vector<int>(10'000'000);
+    std::iota(std::begin(ints), std::end(ints), 0);
+    auto points = vector<Point>(5'000'000);
+    for (auto & p : points) p = Point{rand() % 1000, 0, (rand() % 500) / 100.0};
+
+    // same results as the sequential versions, for any number of threads
+    {
+        auto pool = ForkJoinPool{4};
+        cout << "fast:       " << fast(pool, matrix) << " == " << numRows * numRows << '\n';
+        cout << "sum_scores: " << sum_scores(pool, smalls) << " == "
+             << std::accumulate(std::begin(smalls), std::end(smalls), 0ll,
+                                [](auto sum, auto const & s) { return sum + s.score; }) << '\n';
+        cout << boolalpha << "contains:   " << contains(pool, ints, 9'999'999) << ' '
+                                            << contains(pool, ints, -1) << '\n';
+        cout << "sum:        " << parallel_reduce(pool, ints, 0ll, std::plus<>{}) << " == "
+             << std::accumulate(std::begin(ints), std::end(ints), 0ll) << '\n';
+        cout << "get_max_x:  " << get_max_x(pool, points) << " == " << get_max_x(points) << '\n';
+    }
+
+    // scaling: time in us per kernel for 1..N threads
+    auto const maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    cout << "\nthreads   fast  sum_scores  contains  get_max_x\n";
+    for (auto numThreads = 1u; numThreads <= maxThreads; ++numThreads) {
+        auto pool = ForkJoinPool{numThreads};
+        auto checksum = 0ll;
+        cout << numThreads
+             << "  " << measure_us([&] { checksum += fast(pool, matrix); })
+             << "  " << measure_us([&] { checksum += sum_scores(pool, smalls); })
+             << "  " << measure_us([&] { checksum += contains(pool, ints, 9'999'999); })
+             << "  " << measure_us([&] { checksum += get_max_x(pool, points); })
+             << "  (" << checksum << ")\n";
+    }
+    // -O3, on a VM with a single core, so there is nothing to scale here:
+    // threads   fast  sum_scores  contains  get_max_x
+    // 1  11654  11796  6319  93024
+}
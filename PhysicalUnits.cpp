@@ -1,16 +1,160 @@
 /* physical unit handling at compile time.
  *
- * compile time computation, physical units, user defined literals
+ * compile time computation, physical units, user defined literals, fixed point, std::ratio, performance
  *
  * motivator: Clean C++ Chapter 05
  * Physical units can be expressed as classes so that the compiler
  * can assist in checking the computations and value assignments.
  * Furthermore used defined literals allow to naturally refer to quantities
  * with a unit by a suffix.
+ *
+ * The representation of the magnitude is a template parameter (`double` by
+ * default). `long double` is the x87 80 bit format on x86-64: 16 bytes per
+ * value, no SIMD and slow. `float` halves the memory traffic of `double`,
+ * `Fixed<FractionalBits>` gives exact, deterministic arithmetic on integers.
+ * Mixing representations works like std::chrono::duration:
+ *  - arithmetic is done in the `std::common_type` of both representations
+ *    (int and float -> float, float and double -> double, Fixed and
+ *    double -> double, Fixed and int -> Fixed)
+ *  - a `Value` converts implicitly into a value with another representation
+ *    only if nothing is lost (into a floating point type with at least as
+ *    many digits, so int -> double but not int -> float or Fixed -> double,
+ *    or from an integer into a `Fixed`), everything else requires
+ *    `value_cast<Rep>`.
+ *
+ * The unit is a `std::ratio` in the type as well (`Kilometers` is a length
+ * with `Scale` std::kilo, `Grams` a mass with std::milli since the base is
+ * kg), again like the period of std::chrono::duration. The conversion factor
+ * between two scales is computed by the compiler, so
+ *  - `*` and `/` never convert, they only combine the scales in the type
+ *    (km * km is a `Value<MKS<2,0,0>, double, std::mega>`)
+ *  - `+` and `-` rescale both operands into their common scale, that is at
+ *    most one multiplication by a constant per operand and none for the
+ *    operand already in the common scale
+ *  - converting into a coarser scale with an integral or `Fixed`
+ *    representation drops fractions, so it requires `value_cast<Value<...>>`
+ *    like narrowing does. It multiplies by the numerator of the factor and
+ *    then divides by the denominator, so nothing is lost but the remainder.
+ * The `static_assert`s of the Scaling Tests section prove the folding.
  */
 
+#include <chrono>
+#include <concepts>
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <numeric>
+#include <ratio>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = std::chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+//--------------------------------------------------------------------------------------------Fixed
+
+// signed fixed point number with `FractionalBits` bits after the binary point
+template <int FractionalBits>
+class Fixed {
+    std::int64_t raw_{0};
+    static constexpr std::int64_t one = std::int64_t{1} << FractionalBits;
+public:
+    constexpr Fixed() noexcept = default;
+    constexpr Fixed(std::int32_t const i) noexcept : raw_{std::int64_t{i} * one} {}
+    // rounded to the nearest multiple of 2^-FractionalBits, throws (or doesn't compile) if out of range
+    constexpr explicit Fixed(long double const d) : raw_{0} {
+        auto const scaled = d * one;
+        if (!(scaled > -0x1p63L && scaled < 0x1p63L)) throw std::out_of_range{"Fixed: out of range"};  // also NaN
+        raw_ = static_cast<std::int64_t>(scaled + (d < 0 ? -0.5L : 0.5L));
+    }
+    // float and double: otherwise ambiguous between the two constructors above
+    template <std::floating_point F>
+    constexpr explicit Fixed(F const d) : Fixed{static_cast<long double>(d)} {}
+
+    template <typename T>
+        requires std::is_arithmetic_v<T>
+    constexpr explicit operator T() const noexcept { return static_cast<T>(static_cast<long double>(raw_) / one); }
+
+    friend constexpr Fixed operator+(Fixed lhs, Fixed rhs) noexcept { return fromRaw(lhs.raw_ + rhs.raw_); }
+    friend constexpr Fixed operator-(Fixed lhs, Fixed rhs) noexcept { return fromRaw(lhs.raw_ - rhs.raw_); }
+#ifdef __SIZEOF_INT128__  // GCC and Clang on 64 bit targets
+    friend constexpr Fixed operator*(Fixed lhs, Fixed rhs) noexcept {
+        return fromRaw(static_cast<std::int64_t>((__int128{lhs.raw_} * rhs.raw_) >> FractionalBits));
+    }
+    friend constexpr Fixed operator/(Fixed lhs, Fixed rhs) noexcept {
+        return fromRaw(static_cast<std::int64_t>((__int128{lhs.raw_} << FractionalBits) / rhs.raw_));
+    }
+#else  // in 64 bits, exact as long as the raw values stay below 2^(63 - FractionalBits)
+    friend constexpr Fixed operator*(Fixed lhs, Fixed rhs) noexcept {
+        auto const whole = rhs.raw_ >> FractionalBits, fraction = rhs.raw_ & (one - 1);
+        return fromRaw(lhs.raw_ * whole + ((lhs.raw_ * fraction) >> FractionalBits));
+    }
+    friend constexpr Fixed operator/(Fixed lhs, Fixed rhs) noexcept {
+        auto const quotient = lhs.raw_ / rhs.raw_, remainder = lhs.raw_ % rhs.raw_;
+        return fromRaw(quotient * one + remainder * one / rhs.raw_);
+    }
+#endif
+    friend constexpr bool operator==(Fixed, Fixed) noexcept = default;
+    friend std::ostream & operator<<(std::ostream & out, Fixed f) { return out << static_cast<double>(f); }
+
+private:
+    static constexpr Fixed fromRaw(std::int64_t const raw) noexcept { auto f = Fixed{}; f.raw_ = raw; return f; }
+};
+
+template <typename T> struct IsFixed : std::false_type {};
+template <int F> struct IsFixed<Fixed<F>> : std::true_type {};
+
+// Fixed and floating point -> floating point, Fixed and integer -> Fixed
+template <int F, typename T>
+    requires std::is_arithmetic_v<T>
+struct std::common_type<Fixed<F>, T> {
+    using type = std::conditional_t<std::is_floating_point_v<T>, T, Fixed<F>>;
+};
+
+template <int F, typename T>
+    requires std::is_arithmetic_v<T>
+struct std::common_type<T, Fixed<F>> : std::common_type<Fixed<F>, T> {};
+
+// conversions that lose nothing: int -> double, but not int -> float (24 digits) or int64 -> double (53),
+// and a Fixed has the 63 significant bits of its raw value, only long double (64 on x86) holds them
+template <typename From, typename To>
+constexpr bool isLossless = [] {
+    if constexpr (std::is_floating_point_v<To>)
+        return std::numeric_limits<To>::digits
+            >= (IsFixed<From>::value ? std::numeric_limits<std::int64_t>::digits : std::numeric_limits<From>::digits);
+    else if constexpr (IsFixed<To>::value)
+        return std::is_same_v<From, To> || (std::is_integral_v<From> && sizeof(From) <= sizeof(std::int32_t));
+    else
+        return std::is_convertible_v<From, To> && requires (From f) { To{f}; };  // not narrowing
+}();
+
+//---------------------------------------------------------------------------------------------Value
 
 template <int M, int K, int S>
 struct MKS {
@@ -18,14 +162,68 @@ struct MKS {
 };
 
 
-template <typename MKS>
+// `magnitude` in units of `From` -> in units of `To`, the factor is computed at compile time
+template <typename From, typename To, typename Rep>
+constexpr Rep rescale(Rep const magnitude) noexcept {
+    using Factor = std::ratio_divide<From, To>;
+    if constexpr (Factor::num == 1 && Factor::den == 1)
+        return magnitude;
+    else if constexpr (std::is_integral_v<Rep>)
+        return magnitude * static_cast<Rep>(Factor::num) / static_cast<Rep>(Factor::den);
+    else if constexpr (IsFixed<Rep>::value) {
+        // the raw value times num, then divided by den: a pre-rounded Fixed<16>{0.001} would be 66/65536, 0.7% off
+        static_assert(Factor::num <= std::numeric_limits<std::int32_t>::max()
+                   && Factor::den <= std::numeric_limits<std::int32_t>::max(), "scale factor too large for Fixed");
+        return magnitude * Rep{static_cast<std::int32_t>(Factor::num)} / Rep{static_cast<std::int32_t>(Factor::den)};
+    }
+    else {
+        constexpr auto factor = static_cast<Rep>(static_cast<long double>(Factor::num) / Factor::den);
+        return magnitude * factor;
+    }
+}
+
+// as std::chrono::duration: the largest scale both are integer multiples of
+template <typename L, typename R>
+using CommonScale = std::ratio<std::gcd(L::num, R::num), std::lcm(L::den, R::den)>;
+
+// integers and fixed point numbers can't represent (all) fractions of the source scale
+template <typename From, typename To, typename Rep>
+constexpr bool isLosslessScale = !(std::is_integral_v<Rep> || IsFixed<Rep>::value) || std::ratio_divide<From, To>::den == 1;
+
+
+// `Scale` is the unit of the magnitude in multiples of the SI base unit, e.g. std::kilo for km
+template <typename MKS, typename Rep = double, typename Scale = std::ratio<1>>
 class Value {
-    long double magnitude_{0.0};
+    Rep magnitude_{0};
 public:
-    constexpr explicit Value (long double const magnitude) noexcept :magnitude_(magnitude) {}
-    constexpr long double magnitude() const noexcept { return magnitude_; }
+    using rep = Rep;
+    using scale = typename Scale::type;
+
+    constexpr Value() noexcept = default;
+    constexpr explicit Value (Rep const magnitude) noexcept :magnitude_(magnitude) {}
+
+    // implicit only if lossless, see `value_cast` otherwise
+    template <typename Rep2, typename Scale2>
+        requires (!std::is_same_v<Value, Value<MKS, Rep2, Scale2>>)
+    constexpr explicit(!isLossless<Rep2, Rep> || !isLosslessScale<Scale2, Scale, Rep>)
+    Value (Value<MKS, Rep2, Scale2> const & other) noexcept(std::is_nothrow_constructible_v<Rep, Rep2>)  // Fixed can throw
+        : magnitude_(rescale<Scale2, Scale>(static_cast<Rep>(other.magnitude()))) {}
+
+    constexpr Rep magnitude() const noexcept { return magnitude_; }
 };
 
+template <typename T> struct IsValue : std::false_type {};
+template <typename MKS, typename Rep, typename Scale> struct IsValue<Value<MKS, Rep, Scale>> : std::true_type {};
+
+// value_cast<float>(v) changes the representation, value_cast<Length>(v) representation and scale
+template <typename To, typename MKS, typename Rep, typename Scale>
+constexpr auto value_cast(Value<MKS, Rep, Scale> const & value)
+    noexcept(IsValue<To>::value ? std::is_nothrow_constructible_v<To, Value<MKS, Rep, Scale>>
+                                : std::is_nothrow_constructible_v<To, Rep>) {
+    if constexpr (IsValue<To>::value) return To{value};
+    else return Value<MKS, To, Scale>{static_cast<To>(value.magnitude())};
+}
+
 
 using Dimensionless = Value<MKS< 0, 0,  0>>;
 using Length        = Value<MKS< 1, 0,  0>>;
@@ -39,6 +237,10 @@ using Frequency     = Value<MKS< 0, 0, -1>>;
 using Force         = Value<MKS< 1, 1, -2>>;
 using Pressure      = Value<MKS<-1, 1, -2>>;
 
+using Kilometers    = Value<MKS< 1, 0,  0>, double, std::kilo>;
+using Grams         = Value<MKS< 0, 1,  0>, double, std::milli>;  // the base unit is kg
+using Milliseconds  = Value<MKS< 0, 0,  1>, double, std::milli>;
+
 
 constexpr Acceleration gravitaionalAccelerationOnEarth{9.80665};
 constexpr Pressure standardPressureOnSeaLevel{1013.25};
@@ -47,48 +249,213 @@ constexpr Frequency concestPitchA{440.0};
 constexpr Mass neutronMass{1.6749286e-27};
 
 
-template <int M, int K, int S>
-constexpr Value<MKS<M,K,S>>
-operator+(Value<MKS<M,K,S>> const & lhs,
-          Value<MKS<M,K,S>> const & rhs) {
-    return Value<MKS<M,K,S>>{lhs.magnitude() + rhs.magnitude()};
+// + and - convert into the common scale first, that is a multiplication by a constant or nothing
+template <int M, int K, int S, typename RL, typename RR, typename SL, typename SR>
+constexpr Value<MKS<M,K,S>, std::common_type_t<RL, RR>, CommonScale<SL, SR>>
+operator+(Value<MKS<M,K,S>, RL, SL> const & lhs,
+          Value<MKS<M,K,S>, RR, SR> const & rhs) {
+    using R = std::common_type_t<RL, RR>;
+    using C = CommonScale<SL, SR>;
+    return Value<MKS<M,K,S>, R, C>{rescale<SL, C>(static_cast<R>(lhs.magnitude()))
+                                 + rescale<SR, C>(static_cast<R>(rhs.magnitude()))};
 }
 
-template <int M, int K, int S>
-constexpr Value<MKS<M,K,S>>
-operator-(Value<MKS<M,K,S>> const & lhs,
-          Value<MKS<M,K,S>> const & rhs) {
-    return Value<MKS<M,K,S>>{lhs.magnitude() - rhs.magnitude()};
+template <int M, int K, int S, typename RL, typename RR, typename SL, typename SR>
+constexpr Value<MKS<M,K,S>, std::common_type_t<RL, RR>, CommonScale<SL, SR>>
+operator-(Value<MKS<M,K,S>, RL, SL> const & lhs,
+          Value<MKS<M,K,S>, RR, SR> const & rhs) {
+    using R = std::common_type_t<RL, RR>;
+    using C = CommonScale<SL, SR>;
+    return Value<MKS<M,K,S>, R, C>{rescale<SL, C>(static_cast<R>(lhs.magnitude()))
+                                 - rescale<SR, C>(static_cast<R>(rhs.magnitude()))};
 }
 
-template <int ML, int KL, int SL, int MR, int KR, int SR>
-constexpr Value<MKS<ML+MR,KL+KR,SL+SR>>
-operator*(Value<MKS<ML,KL,SL>> const & lhs,
-          Value<MKS<MR,KR,SR>> const & rhs) {
-    return Value<MKS<ML+MR,KL+KR,SL+SR>>{lhs.magnitude() * rhs.magnitude()};
+// * and / only combine the scales in the type, no conversion at all
+template <int ML, int KL, int SL, int MR, int KR, int SR, typename RL, typename RR, typename ScL, typename ScR>
+constexpr Value<MKS<ML+MR,KL+KR,SL+SR>, std::common_type_t<RL, RR>, std::ratio_multiply<ScL, ScR>>
+operator*(Value<MKS<ML,KL,SL>, RL, ScL> const & lhs,
+          Value<MKS<MR,KR,SR>, RR, ScR> const & rhs) {
+    using R = std::common_type_t<RL, RR>;
+    return Value<MKS<ML+MR,KL+KR,SL+SR>, R, std::ratio_multiply<ScL, ScR>>{
+        static_cast<R>(lhs.magnitude()) * static_cast<R>(rhs.magnitude())};
 }
 
-template <int ML, int KL, int SL, int MR, int KR, int SR>
-constexpr Value<MKS<ML-MR,KL-KR,SL-SR>>
-operator/(Value<MKS<ML,KL,SL>> const & lhs,
-          Value<MKS<MR,KR,SR>> const & rhs) {
-    return Value<MKS<ML-MR,KL-KR,SL-SR>>{lhs.magnitude() / rhs.magnitude()};
+template <int ML, int KL, int SL, int MR, int KR, int SR, typename RL, typename RR, typename ScL, typename ScR>
+constexpr Value<MKS<ML-MR,KL-KR,SL-SR>, std::common_type_t<RL, RR>, std::ratio_divide<ScL, ScR>>
+operator/(Value<MKS<ML,KL,SL>, RL, ScL> const & lhs,
+          Value<MKS<MR,KR,SR>, RR, ScR> const & rhs) {
+    using R = std::common_type_t<RL, RR>;
+    return Value<MKS<ML-MR,KL-KR,SL-SR>, R, std::ratio_divide<ScL, ScR>>{
+        static_cast<R>(lhs.magnitude()) / static_cast<R>(rhs.magnitude())};
 }
 
 
 constexpr Force operator"" _N(long double magnitude) {
-    return Force{magnitude};
+    return Force{static_cast<double>(magnitude)};
 }
 
 constexpr Acceleration operator"" _ms2(long double magnitude) {
-    return Acceleration{magnitude};
+    return Acceleration{static_cast<double>(magnitude)};
 }
 
 constexpr Time operator"" _s(long double magnitude) {
-    return Time{magnitude};
+    return Time{static_cast<double>(magnitude)};
+}
+
+constexpr Milliseconds operator"" _ms(long double magnitude) {
+    return Milliseconds{static_cast<double>(magnitude)};
+}
+
+constexpr Length operator"" _m(long double magnitude) {
+    return Length{static_cast<double>(magnitude)};
+}
+
+constexpr Kilometers operator"" _km(long double magnitude) {
+    return Kilometers{static_cast<double>(magnitude)};
+}
+
+constexpr Mass operator"" _kg(long double magnitude) {
+    return Mass{static_cast<double>(magnitude)};
+}
+
+constexpr Grams operator"" _g(long double magnitude) {
+    return Grams{static_cast<double>(magnitude)};
 }
 
+//-------------------------------------------------------------------------------------Scaling Tests
+// everything below is evaluated by the compiler
+
+// the conversion factor is a single constant
+static_assert(rescale<std::kilo, std::ratio<1>>(1.5) == 1500.0);
+static_assert(rescale<std::milli, std::kilo>(1.0) == 1e-6);
+static_assert(rescale<std::kilo, std::milli>(2) == 2'000'000);
+
+// * and / only change the type
+static_assert(std::is_same_v<decltype(2.0_km * 3.0_km), Value<MKS<2, 0, 0>, double, std::mega>>);
+static_assert(std::is_same_v<decltype(1.0_km / 1.0_ms)::scale, std::mega>);  // km/ms = 10^6 m/s
+static_assert((2.0_km * 3.0_km).magnitude() == 6.0);
+
+// + and - rescale into the common scale
+static_assert(std::is_same_v<decltype(1.0_km + 500.0_m), Length>);
+static_assert((1.0_km + 500.0_m).magnitude() == 1500.0);
+static_assert((1.0_s - 250.0_ms).magnitude() == 750.0);  // in ms
+static_assert((1.0_kg + 1.0_g).magnitude() == 1001.0);    // in g
+
+// conversions
+static_assert(Length{2.0_km}.magnitude() == 2000.0);                            // implicit, nothing lost
+static_assert(value_cast<Kilometers>(1500.0_m).magnitude() == 1.5);
+static_assert(!std::is_convertible_v<Value<MKS<1, 0, 0>, int>, Value<MKS<1, 0, 0>, int, std::kilo>>);  // m -> km loses fractions
+static_assert(std::is_convertible_v<Value<MKS<1, 0, 0>, int, std::kilo>, Value<MKS<1, 0, 0>, int>>);
+static_assert(value_cast<Value<MKS<1, 0, 0>, int, std::kilo>>(Value<MKS<1, 0, 0>, int>{2500}).magnitude() == 2);
+static_assert(!std::is_convertible_v<Value<MKS<1, 0, 0>, Fixed<16>>, Value<MKS<1, 0, 0>, Fixed<16>, std::kilo>>);
+static_assert(value_cast<Value<MKS<1, 0, 0>, Fixed<16>, std::kilo>>(Value<MKS<1, 0, 0>, Fixed<16>>{2500}).magnitude()
+              == Fixed<16>{2.5L});  // not 2.5 * 66/65.536
+static_assert(Value<MKS<1, 0, 0>, Fixed<16>>{Value<MKS<1, 0, 0>, Fixed<16>, std::kilo>{3}}.magnitude() == 3000);
+static_assert(value_cast<Fixed<16>>(Mass{2.5}).magnitude() == Fixed<16>{2.5L});                  // double -> Fixed
+static_assert(Value<MKS<0, 1, 0>, Fixed<16>>{Value<MKS<0, 1, 0>, float>{0.25f}}.magnitude() == Fixed<16>{0.25L});
+static_assert(!noexcept(value_cast<Fixed<16>>(Mass{})) && !noexcept(Value<MKS<0, 1, 0>, Fixed<16>>{Mass{}}));  // may throw
+static_assert(noexcept(value_cast<float>(Mass{})) && noexcept(value_cast<Kilometers>(Length{})));
+
+// mixing scales in a formula: speed in m/s from km and ms
+static_assert(value_cast<Speed>(3.0_km / 1500.0_ms).magnitude() == 2000.0);
+
+//--------------------------------------------------------------------------------------------Try It
+
+// total distance of many legs given in km and m, result in m
+template <typename Leg>
+void scaledBenchmark(char const * name, double const runtimeFactor) {
+    constexpr auto n = 1'000'000;
+    auto kilometers = std::vector<Leg>(n, Leg{1.5});
+    auto meters = std::vector<Length>(n, Length{250.0});
+    auto totals = std::vector<Length>(n);
+    {
+        ScopedTimer t{name};
+        for (auto repetition = 0; repetition < 100; ++repetition)
+            for (auto i = 0; i < n; ++i)
+                if constexpr (std::is_same_v<Leg, Length>)  // km stored as plain numbers, factor known at runtime
+                    totals[i] = Length{kilometers[i].magnitude() * runtimeFactor} + meters[i] + totals[i];
+                else
+                    totals[i] = kilometers[i] + meters[i] + totals[i];
+    }
+    std::cout << "  " << totals[n / 2].magnitude() << '\n';  // 175000
+}
+
+// F = m * a for many bodies
+template <typename Rep>
+void benchmark(char const * name) {
+    constexpr auto n = 1'000'000;
+    auto masses = std::vector<Value<MKS<0, 1, 0>, Rep>>(n, Value<MKS<0, 1, 0>, Rep>{Rep(2)});
+    auto accelerations = std::vector<Value<MKS<1, 0, -2>, Rep>>(n, Value<MKS<1, 0, -2>, Rep>{Rep(3)});
+    auto forces = std::vector<Value<MKS<1, 1, -2>, Rep>>(n);
+    {
+        ScopedTimer t{name};
+        for (auto repetition = 0; repetition < 100; ++repetition)
+            for (auto i = 0; i < n; ++i)
+                forces[i] = masses[i] * accelerations[i] + forces[i];
+    }
+    std::cout << "  sizeof " << sizeof(Value<MKS<1, 1, -2>, Rep>) << ", " << forces[n / 2].magnitude() << '\n';  // 600
+}
 
 int main() {
     auto length = Length{2};
+    auto const weight = Mass{80} * gravitaionalAccelerationOnEarth;
+    static_assert(std::is_same_v<decltype(weight), Force const>);
+    std::cout << weight.magnitude() << ' ' << (2.0_N + weight).magnitude() << ' '
+              << (9.81_ms2 * 2.0_s).magnitude() << ' ' << length.magnitude() << '\n';  // 784.532 786.532 19.62 2
+
+    // mixed representations
+    auto const f = Value<MKS<0, 1, 0>, float>{1.5f};
+    auto const i = Value<MKS<0, 1, 0>, int>{2};
+    auto const q = Value<MKS<0, 1, 0>, Fixed<16>>{Fixed<16>{0.25L}};
+    static_assert(std::is_same_v<decltype(f + i)::rep, float>);
+    static_assert(std::is_same_v<decltype(f + Mass{1})::rep, double>);
+    static_assert(std::is_same_v<decltype(q + i)::rep, Fixed<16>>);
+    static_assert(std::is_same_v<decltype(q * f)::rep, float>);
+    std::cout << (f + i).magnitude() << ' ' << (q + i).magnitude() << ' ' << (q * Mass{2}).magnitude() << '\n';  // 3.5 2.25 0.5
+
+    // conversions
+    Mass m = f;                                            // float -> double: implicit
+    Value<MKS<0, 1, 0>, Fixed<16>> fixed = i;              // int -> Fixed: implicit
+    //Value<MKS<0, 1, 0>, float> narrowed = m;             // compile-time error, double -> float narrows
+    auto narrowed = value_cast<float>(m);                  // explicitly
+    auto truncated = value_cast<int>(Mass{2.7});           // 2
+    static_assert(!std::is_convertible_v<Mass, Value<MKS<0, 1, 0>, int>>);
+    static_assert(!std::is_convertible_v<Value<MKS<0, 1, 0>, Fixed<16>>, Value<MKS<0, 1, 0>, int>>);
+    static_assert(std::is_convertible_v<Value<MKS<0, 1, 0>, int>, Mass>);
+    static_assert(!std::is_convertible_v<Value<MKS<0, 1, 0>, int>, Value<MKS<0, 1, 0>, float>>);       // rounds above 2^24
+    static_assert(!std::is_convertible_v<Value<MKS<0, 1, 0>, std::int64_t>, Mass>);                     // rounds above 2^53
+    static_assert(!std::is_convertible_v<Value<MKS<0, 1, 0>, Fixed<16>>, Value<MKS<0, 1, 0>, float>>);  // 2000000001 -> 2e9
+    static_assert(!std::is_convertible_v<Value<MKS<0, 1, 0>, Fixed<16>>, Mass>);
+    static_assert(std::is_convertible_v<Value<MKS<0, 1, 0>, Fixed<16>>, Value<MKS<0, 1, 0>, long double>>
+                  == (std::numeric_limits<long double>::digits >= 63));                                 // x87: 64 digits
+    std::cout << m.magnitude() << ' ' << fixed.magnitude() << ' ' << narrowed.magnitude() << ' '
+              << truncated.magnitude() << '\n';  // 1.5 2 1.5 2
+    try {
+        value_cast<Fixed<16>>(Value<MKS<0, 1, 0>, long double>{1e30L});
+    }
+    catch (std::out_of_range const & e) {
+        std::cout << e.what() << '\n';  // Fixed: out of range
+    }
+
+    // scaled units
+    auto const distance = 1.0_km + 500.0_m;                // in m
+    auto const duration = 1.0_s - 250.0_ms;                // in ms
+    auto const speed = value_cast<Speed>(distance / duration);
+    Length inMeters = 2.5_km;                              // km -> m: implicit
+    auto const inKilometers = value_cast<Kilometers>(distance);
+    auto const grams = 1.0_kg + 1.0_g;                     // in g
+    std::cout << distance.magnitude() << ' ' << duration.magnitude() << ' ' << speed.magnitude() << ' '
+              << inMeters.magnitude() << ' ' << inKilometers.magnitude() << ' '
+              << grams.magnitude() << '\n';  // 1500 750 2000 2500 1.5 1001
+
+    benchmark<long double>("long double");  // 7136213us, -O3: 371582us
+    benchmark<double>("double");            // 3058177us, -O3: 166005us
+    benchmark<float>("float");              // 2956570us, -O3:  32452us
+    benchmark<Fixed<16>>("Fixed<16>");      // 4209302us, -O3: 170808us
+    benchmark<int>("int");                  // 3110869us, -O3: 110154us
+
+    // the scaled type costs exactly one multiplication by 1000 as the hand written conversion,
+    // at -O3 both are bound by memory bandwidth
+    scaledBenchmark<Length>("km as plain numbers, runtime factor", 1000.0);  // 4882618us, -O3: 88752us
+    scaledBenchmark<Kilometers>("km in the type, constexpr factor", 1000.0);  // 4043670us, -O3: 91881us
 }
@@ -0,0 +1,271 @@
+/* dimension checked arrays of physical quantities
+ *
+ * compile time computation, physical units, expression templates, loop fusion, SIMD, performance
+ *
+ * motivator: PhysicalUnits.cpp, CRTP_ExpressionTemplates.cpp
+ *
+ * PhysicalUnits.cpp checks the units of single values. Simulations deal with
+ * millions of forces, masses and accelerations per step. A
+ * `quantity_array<MKS, Rep>` owns the magnitudes of many values of the same
+ * unit in one contiguous array of `Rep` (no per element wrapper), a
+ * `quantity_span<MKS, Rep>` refers to such an array (or any contiguous
+ * memory) without owning it. Assigning to a span writes through to the
+ * elements, also if the right hand side is another span; a span is never
+ * rebound.
+ * Element-wise `+ - * /` of arrays, spans and scalar `Value`s build
+ * expression templates (see CRTP_ExpressionTemplates.cpp) that carry the
+ * resulting unit in their type, computed at compile time just like
+ * `operator*` of `Value` does. Assigning an expression to an array or span of
+ * a different unit does not compile. Evaluation is a single loop over raw
+ * `Rep`s, which the compiler fuses and vectorizes just like a hand written
+ * loop over `double`s, see the benchmark.
+ *
+ * compile using `g++ --std=c++20 -O3 -march=native`
+ */
+
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = std::chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+//---------------------------------------------------------------------------------------------Value
+// as in PhysicalUnits.cpp
+
+template <int M, int K, int S>
+struct MKS {
+    enum {meter = M, kilogram = K, second = S};
+};
+
+template <typename L, typename R>
+using MultipliedMKS = MKS<int{L::meter} + R::meter, int{L::kilogram} + R::kilogram, int{L::second} + R::second>;
+
+template <typename L, typename R>
+using DividedMKS = MKS<int{L::meter} - R::meter, int{L::kilogram} - R::kilogram, int{L::second} - R::second>;
+
+
+template <typename MKS, typename Rep = double>
+class Value {
+    Rep magnitude_{0};
+public:
+    using rep = Rep;
+    constexpr Value() noexcept = default;
+    constexpr explicit Value (Rep const magnitude) noexcept :magnitude_(magnitude) {}
+    constexpr Rep magnitude() const noexcept { return magnitude_; }
+};
+
+
+using Mass          = Value<MKS< 0, 1,  0>>;
+using Time          = Value<MKS< 0, 0,  1>>;
+using Speed         = Value<MKS< 1, 0, -1>>;
+using Acceleration  = Value<MKS< 1, 0, -2>>;
+using Force         = Value<MKS< 1, 1, -2>>;
+
+//------------------------------------------------------------------------------------------Expression
+
+// element-wise expression, `MKS` is the unit of its elements, `Rep` their representation
+template <typename E, typename MKS, typename Rep>
+struct QuantityExpression {
+    E const & self() const { return static_cast<E const &>(*this); }
+};
+
+template <typename MKS, typename Rep> class quantity_array;
+
+// arrays are held by reference, everything else (spans, scalars, nodes) by value
+template <typename E>
+struct Stored { using type = E; };
+template <typename MKS, typename Rep>
+struct Stored<quantity_array<MKS, Rep>> { using type = quantity_array<MKS, Rep> const &; };
+
+template <typename L, typename R, typename MKS, typename Rep, typename Op>
+class BinaryNode : public QuantityExpression<BinaryNode<L, R, MKS, Rep, Op>, MKS, Rep> {
+    typename Stored<L>::type lhs_;
+    typename Stored<R>::type rhs_;
+public:
+    BinaryNode( L const & lhs, R const & rhs ) : lhs_{lhs}, rhs_{rhs} { assert(lhs.size() == rhs.size()); }
+    Rep operator[]( std::size_t i ) const { return Op{}(lhs_[i], rhs_[i]); }
+    std::size_t size() const { return lhs_.size(); }
+};
+
+// a scalar `Value` is "broadcast" to every element
+template <typename L, typename MKSR, typename Rep, typename MKS, typename Op, bool ScalarLeft>
+class ScalarNode : public QuantityExpression<ScalarNode<L, MKSR, Rep, MKS, Op, ScalarLeft>, MKS, Rep> {
+    typename Stored<L>::type array_;
+    Rep scalar_;
+public:
+    ScalarNode( L const & array, Value<MKSR, Rep> scalar ) : array_{array}, scalar_{scalar.magnitude()} {}
+    Rep operator[]( std::size_t i ) const {
+        if constexpr (ScalarLeft) return Op{}(scalar_, array_[i]);
+        else return Op{}(array_[i], scalar_);
+    }
+    std::size_t size() const { return array_.size(); }
+};
+
+//---------------------------------------------------------------------------------------Containers
+
+template <typename MKS, typename Rep = double>
+class quantity_span : public QuantityExpression<quantity_span<MKS, Rep>, MKS, Rep> {
+    std::span<Rep> magnitudes_;
+public:
+    explicit quantity_span( std::span<Rep> magnitudes ) : magnitudes_{magnitudes} {}
+    quantity_span( quantity_array<MKS, Rep> & array ) : magnitudes_{array.magnitudes()} {}
+    quantity_span( quantity_span const & ) = default;
+
+    // copies the elements like any other expression does, it never rebinds the span
+    quantity_span const & operator=( quantity_span const & other ) const {
+        return *this = static_cast<QuantityExpression<quantity_span, MKS, Rep> const &>(other);
+    }
+
+    template <typename E>
+    quantity_span const & operator=( QuantityExpression<E, MKS, Rep> const & e ) const {
+        auto const & expression = e.self();
+        assert(expression.size() == size());
+        auto * const out = magnitudes_.data();
+        for (auto i = std::size_t{0}; i < size(); ++i) out[i] = expression[i];
+        return *this;
+    }
+
+    Rep operator[]( std::size_t i ) const { return magnitudes_[i]; }
+    Value<MKS, Rep> at( std::size_t i ) const { return Value<MKS, Rep>{magnitudes_[i]}; }
+    std::size_t size() const { return magnitudes_.size(); }
+    std::span<Rep> magnitudes() const { return magnitudes_; }
+};
+
+template <typename MKS, typename Rep = double>
+class quantity_array : public QuantityExpression<quantity_array<MKS, Rep>, MKS, Rep> {
+    std::vector<Rep> magnitudes_;
+public:
+    explicit quantity_array( std::size_t size, Value<MKS, Rep> value = {} ) : magnitudes_(size, value.magnitude()) {}
+
+    template <typename E>
+    quantity_array( QuantityExpression<E, MKS, Rep> const & e ) : magnitudes_(e.self().size()) { *this = e; }
+
+    template <typename E>
+    quantity_array & operator=( QuantityExpression<E, MKS, Rep> const & e ) {
+        quantity_span<MKS, Rep>{*this} = e;  // elements only depend on elements with the same index, so aliasing is fine
+        return *this;
+    }
+
+    Rep operator[]( std::size_t i ) const { return magnitudes_[i]; }
+    Value<MKS, Rep> at( std::size_t i ) const { return Value<MKS, Rep>{magnitudes_[i]}; }
+    void set( std::size_t i, Value<MKS, Rep> value ) { magnitudes_[i] = value.magnitude(); }
+    std::size_t size() const { return magnitudes_.size(); }
+    std::span<Rep> magnitudes() { return magnitudes_; }
+    std::span<Rep const> magnitudes() const { return magnitudes_; }
+};
+
+//----------------------------------------------------------------------------------------Operators
+
+template <typename L, typename R, typename M, typename Rep>
+auto operator+( QuantityExpression<L, M, Rep> const & lhs, QuantityExpression<R, M, Rep> const & rhs ) {
+    return BinaryNode<L, R, M, Rep, std::plus<>>{lhs.self(), rhs.self()};
+}
+
+template <typename L, typename R, typename M, typename Rep>
+auto operator-( QuantityExpression<L, M, Rep> const & lhs, QuantityExpression<R, M, Rep> const & rhs ) {
+    return BinaryNode<L, R, M, Rep, std::minus<>>{lhs.self(), rhs.self()};
+}
+
+template <typename L, typename R, typename ML, typename MR, typename Rep>
+auto operator*( QuantityExpression<L, ML, Rep> const & lhs, QuantityExpression<R, MR, Rep> const & rhs ) {
+    return BinaryNode<L, R, MultipliedMKS<ML, MR>, Rep, std::multiplies<>>{lhs.self(), rhs.self()};
+}
+
+template <typename L, typename R, typename ML, typename MR, typename Rep>
+auto operator/( QuantityExpression<L, ML, Rep> const & lhs, QuantityExpression<R, MR, Rep> const & rhs ) {
+    return BinaryNode<L, R, DividedMKS<ML, MR>, Rep, std::divides<>>{lhs.self(), rhs.self()};
+}
+
+template <typename E, typename ME, typename MS, typename Rep>
+auto operator*( QuantityExpression<E, ME, Rep> const & lhs, Value<MS, Rep> const & rhs ) {
+    return ScalarNode<E, MS, Rep, MultipliedMKS<ME, MS>, std::multiplies<>, false>{lhs.self(), rhs};
+}
+
+template <typename E, typename ME, typename MS, typename Rep>
+auto operator*( Value<MS, Rep> const & lhs, QuantityExpression<E, ME, Rep> const & rhs ) {
+    return ScalarNode<E, MS, Rep, MultipliedMKS<MS, ME>, std::multiplies<>, true>{rhs.self(), lhs};
+}
+
+template <typename E, typename ME, typename MS, typename Rep>
+auto operator/( QuantityExpression<E, ME, Rep> const & lhs, Value<MS, Rep> const & rhs ) {
+    return ScalarNode<E, MS, Rep, DividedMKS<ME, MS>, std::divides<>, false>{lhs.self(), rhs};
+}
+
+//--------------------------------------------------------------------------------------------Try It
+
+constexpr auto numBodies = 1'000'000;
+constexpr auto numSteps = 100;
+
+// one explicit Euler step: a = F / m, v = v + a * dt
+void step( std::vector<double> & v, std::vector<double> const & f, std::vector<double> const & m, double dt ) {
+    for (auto i = std::size_t{0}; i < v.size(); ++i) v[i] = v[i] + f[i] / m[i] * dt;
+}
+
+template <typename Rep>
+void step( quantity_array<MKS<1, 0, -1>, Rep> & v, quantity_array<MKS<1, 1, -2>, Rep> const & f,
+           quantity_array<MKS<0, 1, 0>, Rep> const & m, Value<MKS<0, 0, 1>, Rep> dt ) {
+    v = v + f / m * dt;
+    //v = v + f / m;  // compile-time error, speed plus acceleration
+}
+
+int main() {
+    auto forces = quantity_array<MKS<1, 1, -2>>(3, Force{6});
+    auto masses = quantity_array<MKS<0, 1, 0>>(3, Mass{2});
+    auto const accelerations = quantity_array<MKS<1, 0, -2>>{forces / masses};
+    auto doubled = quantity_array<MKS<1, 1, -2>>(3);
+    quantity_span<MKS<1, 1, -2>>{doubled} = forces * Value<MKS<0, 0, 0>>{2} + forces;
+    //quantity_array<MKS<1, 1, -2>> wrong = forces * masses;  // compile-time error, kg^2 m/s^2 is no force
+    std::cout << accelerations.at(1).magnitude() << ' ' << doubled.at(2).magnitude() << '\n';  // 3 18
+
+    // span = span copies the elements, as span = expression does
+    auto copy = quantity_array<MKS<1, 1, -2>>(3);
+    auto const target = quantity_span<MKS<1, 1, -2>>{copy};
+    target = quantity_span<MKS<1, 1, -2>>{doubled};
+    std::cout << copy.at(0).magnitude() << ' ' << (target.magnitudes().data() == copy.magnitudes().data()) << '\n';  // 18 1
+
+    auto raw_v = std::vector<double>(numBodies, 0.0), raw_f = std::vector<double>(numBodies, 1.0),
+         raw_m = std::vector<double>(numBodies, 2.0);
+    {
+        ScopedTimer t{"raw double arrays"};  // 1201925us, -O3 -march=native: 131958us
+        for (auto i = 0; i < numSteps; ++i) step(raw_v, raw_f, raw_m, 0.01);
+    }
+    auto v = quantity_array<MKS<1, 0, -1>>(numBodies, Speed{0});
+    auto const f = quantity_array<MKS<1, 1, -2>>(numBodies, Force{1});
+    auto const m = quantity_array<MKS<0, 1, 0>>(numBodies, Mass{2});
+    {
+        ScopedTimer t{"quantity arrays"};    // 5472386us, -O3 -march=native: 139984us (both loops vectorized, see -fopt-info-vec)
+        for (auto i = 0; i < numSteps; ++i) step(v, f, m, Time{0.01});
+    }
+    std::cout << raw_v[42] << " == " << v.at(42).magnitude() << '\n';  // 0.5 == 0.5
+}
@@ -0,0 +1,443 @@
+/* Locking policies: null lock, spinlock with backoff, futex mutex, reader-writer lock
+ *
+ * policy-based design, concurrency, mutex, spinlock, futex, atomics, reader-writer lock, zero overhead
+ *
+ * motivation: Policies.cpp
+ *
+ * Policies.cpp lets the user of a host class choose its behaviour at compile
+ * time. Whether a class has to be thread safe is such a choice: a memory
+ * pool, the subject of an observer or a logger that is used by one thread
+ * only should not pay for a lock, the same class shared by many threads
+ * must. Here the hosts take a `LockPolicy` template parameter (anything with
+ * `lock()` and `unlock()`, i.e. also `std::mutex`):
+ *  - `NullLock` does nothing. It is an empty member with
+ *    `[[no_unique_address]]`, so the host does not grow, and the calls are
+ *    inlined to nothing: a single threaded host costs as much as one
+ *    written without locks.
+ *  - `Spinlock` is a test-and-test-and-set spinlock: it only tries to set
+ *    the flag (an exclusive access to the cache line) after it has seen it
+ *    cleared (a shared access), so waiting threads do not steal the cache
+ *    line from each other. Between the tests it backs off exponentially with
+ *    `pause` (which also tells the core that this is a spin loop) and yields
+ *    once the backoff is at its maximum, the owner may not be running. Best
+ *    for very short critical sections and more cores than threads.
+ *  - `FutexMutex` is the mutex of Ulrich Drepper's "Futexes Are Tricky" with
+ *    the states unlocked, locked and locked with waiters. Locking and
+ *    unlocking without contention is one atomic operation; only waiters
+ *    sleep in the kernel, via `std::atomic::wait`, which libstdc++
+ *    implements with a futex on Linux (see Concurrency_LightweightFuture.cpp).
+ *  - `RwLock` is a futex reader-writer lock: any number of readers or one
+ *    writer. A waiting writer blocks new readers, so a stream of readers
+ *    cannot starve the writers.
+ * A host locks with `std::lock_guard` where it writes and with `readLock`
+ * where it only reads: that is a `std::shared_lock` for policies with
+ * `lock_shared()` (`RwLock`, `std::shared_mutex`) and a plain lock otherwise.
+ * The benchmark was run on a single core, where spinning threads take time
+ * from the owner of the lock; with more cores the spinlock does better (see
+ * the note at the table).
+ *
+ * compile using `g++ --std=c++20 -O3 -pthread`
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>  // _mm_pause
+#endif
+using namespace std;
+
+constexpr std::size_t cacheLineSize = 64;  // Linux: `getconf LEVEL1_DCACHE_LINESIZE`
+
+// tells the core that this is a spin loop, elsewhere at least lets the owner of the lock run
+inline void cpuRelax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+//------------------------------------------------------------------------------------------Policies
+
+struct NullLock {
+    constexpr void lock()          noexcept {}
+    constexpr void unlock()        noexcept {}
+    constexpr void lock_shared()   noexcept {}
+    constexpr void unlock_shared() noexcept {}
+};
+
+class Spinlock {
+public:
+    void lock() noexcept {
+        for (auto backoff = minBackoff; ; ) {
+            if (!locked_.exchange(true, std::memory_order_acquire)) return;  // test-and-set
+            do {                                                             // test, shared access only
+                for (auto i = 0u; i < backoff; ++i) cpuRelax();
+                if (backoff < maxBackoff) backoff *= 2;
+                else std::this_thread::yield();
+            } while (locked_.load(std::memory_order_relaxed));
+        }
+    }
+
+    void unlock() noexcept { locked_.store(false, std::memory_order_release); }
+
+private:
+    static constexpr unsigned minBackoff = 4;
+    static constexpr unsigned maxBackoff = 1024;
+
+    alignas(cacheLineSize) std::atomic<bool> locked_{false};
+};
+
+class FutexMutex {
+public:
+    void lock() noexcept {
+        auto state = unlocked;
+        if (state_.compare_exchange_strong(state, locked, std::memory_order_acquire, std::memory_order_relaxed))
+            return;  // no system call without contention
+        if (state != contended) state = state_.exchange(contended, std::memory_order_acquire);
+        while (state != unlocked) {
+            state_.wait(contended, std::memory_order_relaxed);
+            state = state_.exchange(contended, std::memory_order_acquire);
+        }
+    }
+
+    void unlock() noexcept {
+        if (state_.exchange(unlocked, std::memory_order_release) == contended)
+            state_.notify_one();  // only if somebody may sleep
+    }
+
+private:
+    static constexpr std::uint32_t unlocked  = 0;
+    static constexpr std::uint32_t locked    = 1;
+    static constexpr std::uint32_t contended = 2;  // locked, maybe with waiters
+
+    alignas(cacheLineSize) std::atomic<std::uint32_t> state_{unlocked};
+};
+
+// state_: the number of readers, `writer` if a writer owns the lock, `pending` if a writer waits,
+// `waiting` if somebody sleeps (or is about to): unlocking only makes a system call then. Whoever
+// notifies clears `waiting` and wakes all sleepers, those who still have to wait set it again.
+class RwLock {
+public:
+    void lock() noexcept {
+        auto state = state_.load(std::memory_order_relaxed);
+        for (;;) {
+            if ((state & ~(pending | waiting)) == 0) {  // keep `waiting`, the sleepers are still there
+                if (state_.compare_exchange_weak(state, writer | (state & waiting),
+                                                 std::memory_order_acquire, std::memory_order_relaxed))
+                    return;
+                continue;
+            }
+            if (!sleep(state, pending | waiting)) continue;  // also keeps new readers out
+            state = state_.load(std::memory_order_relaxed);
+        }
+    }
+
+    void unlock() noexcept {
+        // a still waiting writer sets `pending` again
+        if (state_.exchange(0, std::memory_order_release) & waiting) state_.notify_all();
+    }
+
+    void lock_shared() noexcept {
+        auto state = state_.load(std::memory_order_relaxed);
+        for (;;) {
+            if (state & (writer | pending)) {
+                if (sleep(state, waiting)) state = state_.load(std::memory_order_relaxed);
+            }
+            else if (state_.compare_exchange_weak(state, state + 1, std::memory_order_acquire, std::memory_order_relaxed))
+                return;
+        }
+    }
+
+    void unlock_shared() noexcept {
+        auto state = state_.load(std::memory_order_relaxed);
+        for (;;) {
+            auto next = state - 1;
+            auto const wake = (next & readers) == 0 && (next & waiting);  // the last reader lets the writer in
+            if (wake) next &= ~waiting;
+            if (state_.compare_exchange_weak(state, next, std::memory_order_release, std::memory_order_relaxed)) {
+                if (wake) state_.notify_all();
+                return;
+            }
+        }
+    }
+
+private:
+    static constexpr std::uint32_t writer  = 1u << 31;
+    static constexpr std::uint32_t pending = 1u << 30;
+    static constexpr std::uint32_t waiting = 1u << 29;
+    static constexpr std::uint32_t readers = waiting - 1;
+
+    // sets `flags` and sleeps until state_ changes, false if state_ changed before
+    bool sleep(std::uint32_t & state, std::uint32_t const flags) noexcept {
+        if ((state & flags) != flags) {
+            if (!state_.compare_exchange_weak(state, state | flags, std::memory_order_relaxed)) return false;
+            state |= flags;
+        }
+        state_.wait(state, std::memory_order_relaxed);
+        return true;
+    }
+
+    alignas(cacheLineSize) std::atomic<std::uint32_t> state_{0};
+};
+
+template <typename Lock>
+concept SharedLockable = requires(Lock & lock) {
+    lock.lock_shared();
+    lock.unlock_shared();
+};
+
+// shared for reader-writer policies, exclusive otherwise
+template <typename Lock>
+auto readLock(Lock & lock) {
+    if constexpr (SharedLockable<Lock>) return std::shared_lock{lock};
+    else return std::unique_lock{lock};
+}
+
+//---------------------------------------------------------------------------------------------Hosts
+
+// a monotonic pool, see CustomMemoryManagement.cpp
+template <std::size_t N, typename LockPolicy = NullLock>
+class MemoryPool {
+public:
+    MemoryPool() noexcept : used_(buffer_) {}
+
+    MemoryPool(MemoryPool const &)            = delete;
+    MemoryPool& operator=(MemoryPool const &) = delete;
+
+    auto used() const { auto guard = readLock(lock_); return static_cast<std::size_t>(used_ - buffer_); }
+
+    auto allocate(std::size_t const n) -> std::byte* {
+        auto const aligned_n = align_up(n);
+        {
+            auto guard = std::lock_guard{lock_};
+            if (static_cast<std::size_t>(buffer_ + N - used_) >= aligned_n) {
+                auto* result = used_;
+                used_ += aligned_n;
+                return result;
+            }
+        }
+        return static_cast<std::byte*>(::operator new(n));
+    }
+
+    // only the last allocation is given back to the pool
+    auto deallocate(std::byte* const p, std::size_t const n) -> void {
+        if (!pointer_is_in_buffer(p)) return ::operator delete(p);
+        auto guard = std::lock_guard{lock_};
+        if (p + align_up(n) == used_) used_ = p;
+    }
+
+private:
+    static constexpr std::size_t alignment = alignof(std::max_align_t);
+    static auto align_up(std::size_t const n) noexcept -> std::size_t { return (n + alignment - 1) & ~(alignment - 1); }
+    auto pointer_is_in_buffer(std::byte const * const p) const noexcept -> bool {
+        return std::uintptr_t(p) >= std::uintptr_t(buffer_) && std::uintptr_t(p) < std::uintptr_t(buffer_) + N;
+    }
+
+    alignas(alignment) std::byte buffer_[N];
+    std::byte* used_{};
+    [[no_unique_address]] mutable LockPolicy lock_;
+};
+
+// Observer.cpp
+template <typename State>
+struct ObserverI {
+    virtual void notify(State const &) = 0;
+protected:
+    ~ObserverI() = default;
+};
+
+template <typename State, typename LockPolicy = NullLock>
+class Subject {
+public:
+    void setState(State newState) { auto guard = std::lock_guard{lock_}; state_ = newState; }
+
+    void doregister(ObserverI<State>* newObserver) {
+        auto guard = std::lock_guard{lock_};
+        observers_.push_back(newObserver);
+    }
+
+    void unregister(ObserverI<State>* observer) {
+        auto guard = std::lock_guard{lock_};
+        observers_.erase(std::remove(observers_.begin(), observers_.end(), observer), observers_.end());
+    }
+
+    // concurrently with a reader-writer policy, the observers have to be thread safe then
+    void notifyObservers() const {
+        auto guard = readLock(lock_);
+        for (auto & observer : observers_) observer->notify(state_);
+    }
+
+private:
+    State state_{-1};
+    std::vector<ObserverI<State>*> observers_;
+    [[no_unique_address]] mutable LockPolicy lock_;
+};
+
+template <typename LockPolicy = NullLock>
+class Logger {
+public:
+    explicit Logger(std::ostream & out) : out_{&out} {}
+
+    void log(std::string_view message) {
+        auto guard = std::lock_guard{lock_};
+        *out_ << message << '\n';  // whole lines, also from many threads
+    }
+
+private:
+    std::ostream* out_;
+    [[no_unique_address]] LockPolicy lock_;
+};
+
+// single threaded hosts pay nothing
+static_assert(sizeof(Logger<NullLock>) == sizeof(std::ostream*));
+struct UnlockedSubject { int state; std::vector<ObserverI<int>*> observers; };
+static_assert(sizeof(Subject<int, NullLock>) == sizeof(UnlockedSubject));
+static_assert(sizeof(MemoryPool<1024, NullLock>) == 1024 + alignof(std::max_align_t));
+
+//---------------------------------------------------------------------------------------------Try It
+
+template <typename F>
+double nsPerOp(std::size_t const threads, std::size_t const opsPerThread, F f) {
+    auto const start = std::chrono::steady_clock::now();
+    {
+        auto workers = std::vector<std::jthread>{};
+        for (auto t = std::size_t{0}; t < threads; ++t)
+            workers.emplace_back([&, t] { for (auto i = std::size_t{0}; i < opsPerThread; ++i) f(t, i); });
+    }
+    auto const ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return ns / static_cast<double>(threads * opsPerThread);
+}
+
+void print(double const ns) {
+    std::cout << std::setw(12) << std::fixed << std::setprecision(1) << ns << std::flush;
+}
+
+// an allocation and a deallocation from one thread, the lock is never contended
+template <typename Lock>
+void uncontended(char const * name) {
+    auto pool = std::make_unique<MemoryPool<4096, Lock>>();
+    auto const ns = nsPerOp(1, 10'000'000, [&](std::size_t, std::size_t i) {
+        auto* p = pool->allocate(16 + i % 64);
+        pool->deallocate(p, 16 + i % 64);
+    });
+    std::cout << "  " << std::setw(18) << std::left << name << std::right << std::setw(8) << std::fixed
+              << std::setprecision(1) << ns << " ns/op (pool allocate + deallocate)\n";
+}
+
+// many threads increment one counter under the lock
+template <typename Lock>
+void contended(char const * name) {
+    std::cout << "  " << std::setw(18) << std::left << name << std::right;
+    for (auto const threads : {std::size_t{1}, std::size_t{2}, std::size_t{4}, std::size_t{8}}) {
+        auto lock = Lock{};
+        auto counter = std::uint64_t{0};
+        auto const ops = std::size_t{4'000'000} / threads;
+        auto const ns = nsPerOp(threads, ops, [&](std::size_t, std::size_t) {
+            auto guard = std::lock_guard{lock};
+            ++counter;
+        });
+        print(ns);
+        if (counter != threads * ops) std::cout << " (wrong: " << counter << ')';
+    }
+    std::cout << '\n';
+}
+
+struct CountingObserver : ObserverI<int> {
+    void notify(int const & state) override { sum.fetch_add(static_cast<std::uint64_t>(state), std::memory_order_relaxed); }
+    std::atomic<std::uint64_t> sum{0};
+};
+
+// notifications with one (un)registration in 100
+template <typename Lock>
+void readMostly(char const * name) {
+    std::cout << "  " << std::setw(18) << std::left << name << std::right;
+    for (auto const threads : {std::size_t{1}, std::size_t{2}, std::size_t{4}, std::size_t{8}}) {
+        auto observers = std::vector<CountingObserver>(8 + threads);
+        auto subject = Subject<int, Lock>{};
+        subject.setState(1);
+        for (auto i = std::size_t{0}; i < 8; ++i) subject.doregister(&observers[i]);
+        auto const ns = nsPerOp(threads, std::size_t{400'000} / threads, [&](std::size_t t, std::size_t i) {
+            if (i % 100 == 0) {
+                subject.doregister(&observers[8 + t]);
+                subject.unregister(&observers[8 + t]);
+            }
+            else subject.notifyObservers();
+        });
+        print(ns);
+    }
+    std::cout << '\n';
+}
+
+int main() {
+    // the same hosts, single threaded and shared
+    auto out = std::ostringstream{};
+    auto logger = Logger<FutexMutex>{out};
+    {
+        auto workers = std::vector<std::jthread>{};
+        for (auto t = 0; t < 4; ++t)
+            workers.emplace_back([&logger] { for (auto i = 0; i < 1000; ++i) logger.log("a line of a log"); });
+    }
+    auto lines = 0;
+    auto in = std::istringstream{out.str()};
+    for (auto line = std::string{}; std::getline(in, line); ) lines += line == "a line of a log";
+    cout << lines << " whole lines\n";  // 4000
+
+    auto quiet = Logger<>{cout};
+    quiet.log("NullLock: no locking, sizeof(Logger<>) == sizeof(std::ostream*)");
+
+    cout << "one thread, ns per operation\n";
+    uncontended<NullLock>("NullLock");
+    uncontended<Spinlock>("Spinlock");
+    uncontended<FutexMutex>("FutexMutex");
+    uncontended<RwLock>("RwLock");
+    uncontended<std::mutex>("std::mutex");
+
+    cout << "shared counter, ns per increment for 1, 2, 4, 8 threads\n";
+    contended<Spinlock>("Spinlock");
+    contended<FutexMutex>("FutexMutex");
+    contended<RwLock>("RwLock");
+    contended<std::mutex>("std::mutex");
+
+    cout << "subject with 99% notifications, ns per operation for 1, 2, 4, 8 threads\n";
+    readMostly<Spinlock>("Spinlock");
+    readMostly<FutexMutex>("FutexMutex");
+    readMostly<RwLock>("RwLock");
+    readMostly<std::mutex>("std::mutex");
+    readMostly<std::shared_mutex>("std::shared_mutex");
+}
+
+// single core, -O3 (-O0), ns per operation: with one core the threads take turns, none of these numbers
+// shows what the locks do when threads really run in parallel, spinning in particular
+// one thread, pool allocate + deallocate: NullLock 3.7 (74.1), Spinlock 22.3 (109.8), FutexMutex 41.1 (93.4),
+//                                         RwLock 56.0 (101.4), std::mutex 49.3 (102.3)
+// shared counter, threads:         1            2            4            8
+// Spinlock                13.2 (34.5)  12.9 (38.7)  13.4 (39.4)  13.9 (43.1)
+// FutexMutex              21.8 (32.0)  20.3 (31.3)  20.4 (31.2)  21.1 (31.9)
+// RwLock                  28.3 (36.6)  27.7 (35.9)  26.3 (33.1)  26.7 (35.5)
+// std::mutex              28.9 (35.3)  28.5 (32.2)  28.3 (37.9)  28.6 (37.7)
+// subject, 99% notifications:
+// Spinlock                 88.3         93.6         85.1         98.6
+// FutexMutex              110.5         95.2         86.1         83.0
+// RwLock                   91.8        105.5        106.4        107.7
+// std::mutex               97.3         92.9        120.1        101.8
+// std::shared_mutex        88.8        105.5        108.8        119.8
+// With one core the readers never run in parallel, so the reader-writer locks cannot win here. `RwLock`
+// only wakes sleepers if there are any: with 8 writers it used to take 111 ns per increment, when every
+// unlock woke all waiters, now 27 ns. The price is an atomic exchange instead of a store in `unlock`,
+// which shows without contention (23.8 ns before). NullLock hosts cost nothing.
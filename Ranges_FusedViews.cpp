@@ -0,0 +1,468 @@
+/* Fused filter/transform/reduce views that run as branchless kernels
+ *
+ * ranges, views, range adaptors, loop fusion, branchless, vectorization, parallel, performance
+ *
+ * motivation: Ranges01.cpp
+ *
+ * `get_max_x` of Ranges01.cpp pipes the points through `std::views::filter`
+ * and `std::views::transform` into `std::ranges::max_element`. Every step of
+ * the filter iterator is a data dependent branch: with unpredictable data it
+ * mispredicts often, and the loop can't be vectorized because the number of
+ * iterations of the inner "find next match" loop is unknown.
+ * The adaptors of namespace `fused` build the same views, but remember the
+ * predicate and the projection. If a chain `filter | transform` ends in a
+ * reduction (`fused::max`, `fused::reduce`) and the underlying range is
+ * contiguous, the reduction doesn't iterate the view but runs a single loop
+ * over all elements which evaluates predicate and projection for every element
+ * and merges the result with a select instead of a branch:
+ *   accumulator = keep ? op(accumulator, value) : accumulator
+ * This loop has no branches besides the loop condition, so the compiler turns
+ * it into SIMD code where `keep` is a mask (check with -fopt-info-vec, it
+ * needs the 64 bit compares of AVX2, so compile with -march=native).
+ * Loads through member pointers (`transform(&Point::x)`) are not vectorized
+ * by GCC 12, even if the member pointer is a constant. They work, but take a
+ * lambda for speed.
+ * Requirements for the kernel: predicate and projection must be cheap and
+ * have no side effects, they are called for elements that are filtered out
+ * as well. Everything else (non contiguous ranges, chains that end in
+ * something else than a reduction) falls back to the standard views, a fused
+ * view is a `std::ranges::view` itself.
+ * The results are exactly those of the standard views: the reduction is done
+ * in the same order, filtered out elements leave the accumulator untouched.
+ * `fused::max` compares with `<` like `std::ranges::max_element` (values must
+ * not be NaN).
+ * `fused::parallel(reduction)` cuts large inputs into chunks of `grain`
+ * elements that are reduced on all cores and combined in order, as in
+ * ParallelAlgorithms.cpp. Each chunk starts with `init`, so `init` has to be
+ * the identity of `op`, and `op` has to be associative for the result to
+ * match (true for integers and max, not for floating point addition).
+ *
+ * compile using `g++ --std=c++20 -O3 -march=native -pthread`
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <ranges>
+#include <thread>
+#include <type_traits>
+#include <vector>
+using namespace std;
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = std::chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+//-------------------------------------------------------------------------------------------Adaptors
+
+namespace fused {
+
+struct keep_all {
+    constexpr bool operator()(auto const &) const noexcept { return true; }
+};
+
+// iterates like `base | std::views::filter(pred) | std::views::transform(proj)`
+// The kernels need the data of the base. The standard views hand it out by value only, which
+// doesn't compile for a non-copyable base like the `owning_view` of a temporary container. So
+// the base is kept here and the standard views refer to it, built on the first iteration.
+template <std::ranges::view V, typename Pred, typename Proj>
+class filter_transform_view : public std::ranges::view_interface<filter_transform_view<V, Pred, Proj>> {
+public:
+    filter_transform_view(V base, Pred pred, Proj proj)
+        : base_{std::move(base)}, pred_{std::move(pred)}, proj_{std::move(proj)} {}
+
+    // the standard views of `other` refer to its base, a copy builds its own
+    filter_transform_view(filter_transform_view const & other) requires std::copy_constructible<V>
+        : base_{other.base_}, pred_{other.pred_}, proj_{other.proj_} {}
+    filter_transform_view(filter_transform_view && other)
+        : base_{std::move(other.base_)}, pred_{std::move(other.pred_)}, proj_{std::move(other.proj_)} {}
+
+    filter_transform_view & operator=(filter_transform_view const & other)
+        requires std::copyable<V> && std::copyable<Pred> && std::copyable<Proj> {
+        return *this = filter_transform_view{other};
+    }
+    filter_transform_view & operator=(filter_transform_view && other)
+        requires std::movable<V> && std::movable<Pred> && std::movable<Proj> {
+        view_.reset();
+        base_ = std::move(other.base_);
+        pred_ = std::move(other.pred_);
+        proj_ = std::move(other.proj_);
+        return *this;
+    }
+
+    auto begin() { return std::ranges::begin(view()); }
+    auto end()   { return std::ranges::end(view()); }
+
+    V const & base() const & noexcept { return base_; }
+    V base() && { return std::move(base_); }
+    Pred const & pred() const noexcept { return pred_; }
+    Proj const & proj() const noexcept { return proj_; }
+
+private:
+    using Filtered = std::ranges::filter_view<std::ranges::ref_view<V>, Pred>;
+    using StandardViews = std::ranges::transform_view<Filtered, Proj>;
+
+    StandardViews & view() {
+        if (!view_) view_.emplace(Filtered{std::ranges::ref_view<V>{base_}, pred_}, proj_);
+        return *view_;
+    }
+
+    V base_;
+    Pred pred_;
+    Proj proj_;
+    std::optional<StandardViews> view_;
+};
+
+template <typename R>
+constexpr bool isFused = false;
+template <typename V, typename Pred, typename Proj>
+constexpr bool isFused<filter_transform_view<V, Pred, Proj>> = true;
+
+template <typename Pred> struct filter_closure    { Pred pred; };
+template <typename Proj> struct transform_closure { Proj proj; };
+
+template <typename Pred> auto filter(Pred pred)    { return filter_closure<Pred>{std::move(pred)}; }
+template <typename Proj> auto transform(Proj proj) { return transform_closure<Proj>{std::move(proj)}; }
+
+template <std::ranges::viewable_range R, typename Pred>
+    requires (!isFused<std::remove_cvref_t<R>>)
+auto operator|(R && range, filter_closure<Pred> f) {
+    return filter_transform_view{std::views::all(std::forward<R>(range)), std::move(f.pred), std::identity{}};
+}
+
+template <std::ranges::viewable_range R, typename Proj>
+    requires (!isFused<std::remove_cvref_t<R>>)
+auto operator|(R && range, transform_closure<Proj> t) {
+    return filter_transform_view{std::views::all(std::forward<R>(range)), keep_all{}, std::move(t.proj)};
+}
+
+// filter | transform: fused
+template <typename V, typename Pred, typename Proj>
+auto operator|(filter_transform_view<V, Pred, std::identity> view, transform_closure<Proj> t) {
+    auto pred = view.pred();
+    return filter_transform_view{std::move(view).base(), std::move(pred), std::move(t.proj)};
+}
+
+// everything else: standard views
+template <typename V, typename Pred, typename Proj, typename Proj2>
+    requires (!std::same_as<Proj, std::identity>)
+auto operator|(filter_transform_view<V, Pred, Proj> view, transform_closure<Proj2> t) {
+    return std::move(view) | std::views::transform(std::move(t.proj));
+}
+
+template <typename V, typename Pred, typename Proj, typename Pred2>
+auto operator|(filter_transform_view<V, Pred, Proj> view, filter_closure<Pred2> f) {
+    return std::move(view) | std::views::filter(std::move(f.pred));
+}
+
+//-----------------------------------------------------------------------------------------Reductions
+// A reduction knows how to
+//  - reduce any range: `generic(range)`
+//  - start, `step` and `combine` accumulators, and `finish` the result, for the kernels
+
+struct reduction_tag {};
+
+template <typename R>
+concept Reduction = std::derived_from<R, reduction_tag>;
+
+// Values are kept in 64 bit lanes: the mask of a predicate on a `double` (like `in_time`) has 64 bit
+// lanes, and the vectorizer only handles masks and values with the same number of lanes.
+template <typename T>
+using lane_t = std::conditional_t<std::is_integral_v<T> && sizeof(T) < 8,
+                                  std::conditional_t<std::is_signed_v<T>, std::int64_t, std::uint64_t>,
+                                  std::conditional_t<std::is_same_v<T, float>, double, T>>;
+
+// the largest value as in Ranges01.cpp: `max_element`, 0 for an empty range
+struct max_fn : reduction_tag {
+    template <typename T>
+    struct accumulator {
+        lane_t<T> value = std::numeric_limits<T>::lowest();
+        std::int64_t matches = 0;
+    };
+
+    template <typename T>
+    accumulator<T> start() const { return {}; }
+
+    // max(acc, lowest) is acc, so filtered out elements change nothing
+    template <typename T>
+    static void step(accumulator<T> & acc, T const value, bool const keep) {
+        auto const candidate = keep ? lane_t<T>(value) : lane_t<T>(std::numeric_limits<T>::lowest());
+        acc.value = std::max(acc.value, candidate);
+        acc.matches += keep;
+    }
+
+    template <typename T>
+    static void combine(accumulator<T> & acc, accumulator<T> const & next) {
+        acc.value = std::max(acc.value, next.value);
+        acc.matches += next.matches;
+    }
+
+    template <typename T>
+    static T finish(accumulator<T> const & acc) { return acc.matches ? static_cast<T>(acc.value) : T{}; }
+
+    template <std::ranges::range R>
+    auto generic(R && range) const {
+        auto const it = std::ranges::max_element(range);
+        return it != std::ranges::end(range) ? *it : std::ranges::range_value_t<R>{};
+    }
+};
+inline constexpr max_fn max{};
+
+// std::accumulate
+template <typename Init, typename Op>
+struct reduce_fn : reduction_tag {
+    Init init;
+    Op op;
+
+    template <typename T>
+    Init start() const { return init; }
+
+    template <typename T>
+    void step(Init & acc, T const value, bool const keep) const {
+        auto const next = std::invoke(op, acc, value);
+        acc = keep ? next : acc;
+    }
+
+    template <typename T>
+    void combine(Init & acc, Init const & next) const { acc = std::invoke(op, acc, next); }
+
+    template <typename T>
+    static Init finish(Init const & acc) { return acc; }
+
+    template <std::ranges::range R>
+    auto generic(R && range) const {
+        auto acc = init;
+        for (auto && value : range) acc = std::invoke(op, std::move(acc), value);
+        return acc;
+    }
+};
+
+template <typename Init, typename Op = std::plus<>>
+auto reduce(Init init, Op op = {}) { return reduce_fn<Init, Op>{{}, std::move(init), std::move(op)}; }
+
+template <Reduction R>
+struct parallel_fn : reduction_tag {
+    R reduction;
+    unsigned numThreads;
+    std::size_t grain;
+};
+
+template <Reduction R>
+auto parallel(R reduction, unsigned numThreads = std::thread::hardware_concurrency(),
+              std::size_t grain = 64 * 1024) {
+    return parallel_fn<R>{{}, std::move(reduction), std::max(1u, numThreads), grain};
+}
+
+//--------------------------------------------------------------------------------------------Kernels
+
+template <typename R>
+constexpr bool hasKernel = false;
+template <typename V, typename Pred, typename Proj>
+constexpr bool hasKernel<filter_transform_view<V, Pred, Proj>> =
+    std::ranges::contiguous_range<V> && std::ranges::sized_range<V>;
+
+template <typename V, typename Proj>
+using projected_t = std::remove_cvref_t<std::invoke_result_t<Proj const &, std::ranges::range_reference_t<V>>>;
+
+// the branchless loop over [first, last)
+template <typename T, typename R, typename E, typename Pred, typename Proj>
+auto kernel(R const & reduction, E const * const data, std::size_t const first, std::size_t const last,
+            Pred const & pred, Proj const & proj) {
+    auto acc = reduction.template start<T>();
+    for (auto i = first; i < last; ++i) {
+        bool const keep = std::invoke(pred, data[i]);
+        reduction.step(acc, static_cast<T>(std::invoke(proj, data[i])), keep);
+    }
+    return acc;
+}
+
+template <typename V, typename Pred, typename Proj, Reduction R>
+    requires hasKernel<filter_transform_view<V, Pred, Proj>>
+auto operator|(filter_transform_view<V, Pred, Proj> const & view, R const & reduction) {
+    using T = projected_t<V, Proj>;
+    auto const & base = view.base();
+    auto const acc = kernel<T>(reduction, std::ranges::data(base), 0, std::ranges::size(base),
+                               view.pred(), view.proj());
+    return reduction.template finish<T>(acc);
+}
+
+template <typename V, typename Pred, typename Proj, Reduction R>
+    requires hasKernel<filter_transform_view<V, Pred, Proj>>
+auto operator|(filter_transform_view<V, Pred, Proj> const & view, parallel_fn<R> const & p) {
+    using T = projected_t<V, Proj>;
+    auto const & base = view.base();
+    auto const n = static_cast<std::size_t>(std::ranges::size(base));
+    auto const numChunks = (n + p.grain - 1) / p.grain;
+    if (numChunks < 2 || p.numThreads == 1) return view | p.reduction;
+
+    using Accumulator = decltype(p.reduction.template start<T>());
+    auto partials = std::vector<Accumulator>(numChunks, p.reduction.template start<T>());
+    auto next = std::atomic<std::size_t>{0};
+    auto exception = std::exception_ptr{};
+    auto failed = std::atomic_flag{};
+    auto const work = [&] {
+        for (auto chunk = next++; chunk < numChunks; chunk = next++) {
+            try {
+                auto const first = chunk * p.grain;
+                partials[chunk] = kernel<T>(p.reduction, std::ranges::data(base), first, std::min(n, first + p.grain),
+                                            view.pred(), view.proj());
+            }
+            catch (...) { if (!failed.test_and_set()) exception = std::current_exception(); }
+        }
+    };
+    {
+        auto helpers = std::vector<std::jthread>{};
+        for (auto i = 1u; i < std::min<std::size_t>(p.numThreads, numChunks); ++i) helpers.emplace_back(work);
+        work();
+    }
+    if (exception) std::rethrow_exception(exception);
+
+    auto acc = partials.front();
+    for (auto chunk = std::size_t{1}; chunk < numChunks; ++chunk) p.reduction.template combine<T>(acc, partials[chunk]);
+    return p.reduction.template finish<T>(acc);
+}
+
+// no kernel possible
+template <std::ranges::range Range, Reduction R>
+    requires (!hasKernel<std::remove_cvref_t<Range>>)
+auto operator|(Range && range, R const & reduction) {
+    if constexpr (requires { reduction.generic(range); }) return reduction.generic(std::forward<Range>(range));
+    else return std::forward<Range>(range) | reduction.reduction;  // parallel_fn: sequential
+}
+
+}  // namespace fused
+
+//---------------------------------------------------------------------------------------------Points
+
+struct Point {
+    int x, y;
+    double time;
+};
+
+auto const in_time = [](auto&& p){ return 2.0 <= p.time && p.time <= 3.0; };
+
+// for the kernels: GCC 12 does not vectorize loads through member pointers like `&Point::x`
+auto const get_x = [](Point const & p) { return p.x; };
+auto const get_y = [](Point const & p) { return p.y; };
+
+// Ranges01.cpp
+auto max_value(auto&& range) {
+    const auto it = std::ranges::max_element(range);
+    return it != std::end(range) ? *it : 0;
+}
+
+auto get_max_x(vector<Point> const & points) {
+    return max_value(points | std::views::filter(in_time) | std::views::transform(&Point::x));
+}
+
+auto get_max_x_fused(vector<Point> const & points) {
+    return points | fused::filter(in_time) | fused::transform(get_x) | fused::max;
+}
+
+auto get_max_x_parallel(vector<Point> const & points) {
+    return points | fused::filter(in_time) | fused::transform(get_x) | fused::parallel(fused::max);
+}
+
+auto sum_y(vector<Point> const & points) {
+    auto ys = points | std::views::filter(in_time) | std::views::transform(&Point::y);
+    return std::accumulate(std::ranges::begin(ys), std::ranges::end(ys), 0ll);
+}
+
+auto sum_y_fused(vector<Point> const & points) {
+    return points | fused::filter(in_time) | fused::transform(get_y) | fused::reduce(0ll);
+}
+
+auto sum_y_parallel(vector<Point> const & points) {
+    return points | fused::filter(in_time) | fused::transform(get_y) | fused::parallel(fused::reduce(0ll));
+}
+
+auto randomPoints(std::size_t n) {
+    auto engine = std::mt19937{42};
+    auto coordinate = std::uniform_int_distribution{-1'000'000, 1'000'000};
+    auto time = std::uniform_real_distribution{0.0, 5.0};  // 20% are in time, in random order
+    auto points = vector<Point>(n);
+    for (auto & p : points) p = Point{coordinate(engine), coordinate(engine), time(engine)};
+    return points;
+}
+
+//---------------------------------------------------------------------------------------------Try It
+
+template <typename F>
+auto benchmark(char const * name, F f, vector<Point> const & points) {
+    auto result = f(points);
+    {
+        ScopedTimer t{name};
+        for (auto repetition = 0; repetition < 2000; ++repetition) result = f(points);
+    }
+    return result;
+}
+
+int main() {
+    auto const points = vector{Point{1, -1, 1.0}, Point{2, -2, 2.0}, Point{3, -3, 3.0}, Point{4, -4, 4.0}};
+    cout << get_max_x(points) << ' ' << get_max_x_fused(points) << ' ' << get_max_x_parallel(points) << '\n';  // 3 3 3
+    cout << sum_y(points) << ' ' << sum_y_fused(points) << '\n';                                                // -5 -5
+
+    // a fused view still is a view, anything but a reduction uses the standard views
+    auto view = points | fused::filter(in_time) | fused::transform(&Point::x);
+    static_assert(std::ranges::view<decltype(view)>);
+    for (auto x : view | std::views::reverse) cout << x << ' ';                                   // 3 2
+    cout << (std::views::all(points) | std::views::drop(3) | fused::filter(in_time)
+                           | fused::transform(&Point::x) | fused::max) << ' ';  // no match: 0
+    cout << (points | fused::transform(&Point::y) | fused::max) << '\n';                                    // -1
+
+    // temporaries: the fused view owns the container, like the standard views
+    auto const temporary = randomPoints(1000) | fused::filter(in_time) | fused::transform(get_x) | fused::max;
+    auto owning = randomPoints(1000) | fused::filter(in_time) | fused::transform(get_x);
+    cout << (temporary == get_max_x(randomPoints(1000))) << ' '
+         << (std::ranges::max(owning) == temporary) << '\n';                                       // 1 1
+
+    // not contiguous: generic fallback
+    cout << (points | std::views::reverse | fused::filter(in_time) | fused::transform(&Point::x) | fused::max) << '\n';          // 3
+
+    auto const many = randomPoints(100'000);  // 1.6MB, from cache
+    // -O3 without -march=native: all about 2000000us, the branches come back and nothing is vectorized
+    // the parallel variants ran on a single core here
+    auto const expectedMax = benchmark("max, std views", get_max_x, many);                // 16916564us, -O3 -march=native: 1848600us
+    auto const fusedMax = benchmark("max, fused", get_max_x_fused, many);                 // 10054173us, -O3 -march=native:  149001us
+    auto const parallelMax = benchmark("max, fused parallel", get_max_x_parallel, many);  // 10354320us, -O3 -march=native:  170319us
+    auto const expectedSum = benchmark("sum, std views", sum_y, many);                    // 14345622us, -O3 -march=native: 1844454us
+    auto const fusedSum = benchmark("sum, fused", sum_y_fused, many);                     // 17025600us, -O3 -march=native:  139632us
+    auto const parallelSum = benchmark("sum, fused parallel", sum_y_parallel, many);      // 14680807us, -O3 -march=native:  146322us
+    cout << expectedMax << ' ' << fusedMax << ' ' << parallelMax << '\n';
+    cout << expectedSum << ' ' << fusedSum << ' ' << parallelSum << '\n';
+    if (expectedMax != fusedMax || expectedMax != parallelMax || expectedSum != fusedSum || expectedSum != parallelSum)
+        cout << "mismatch!\n";
+}
@@ -0,0 +1,440 @@
+/* A coroutine generator<T> that is a range, with frames from a memory pool
+ *
+ * coroutines, C++20, generator, lazy evaluation, ranges, input range, custom allocator, performance
+ *
+ * motivation: Ranges01.cpp, Concurrency_CoroutineTask.cpp, CustomMemoryManagement.cpp
+ *
+ * The ranges of Ranges01.cpp and GenericAlgorithms.cpp are containers: all
+ * elements exist in memory before the first one is used. A generator is a
+ * coroutine that computes the next element when it is asked for it, with
+ * `co_yield`, and suspends in between. Its state (the local variables) lives
+ * in the coroutine frame, so writing a lazy producer is as easy as writing a
+ * loop, compare `random_points` with the hand written `RandomPoints` range.
+ * `generator<T>` is an input range and a view: `views::filter` and
+ * `views::transform` compose with it without any intermediate vector.
+ * It can be iterated once only, and the reference returned by `*it` is valid
+ * until `++it` resumes the coroutine.
+ * An exception thrown in the body of the generator is rethrown by
+ * `begin()` or `++it`.
+ * The frame is allocated with `operator new` when the generator is created.
+ * Compilers may elide this allocation if the generator does not outlive the
+ * caller (HALO), but g++ never does. Like `std::generator` of C++23, a
+ * generator whose first two parameters are `std::allocator_arg` and an
+ * allocator takes its frame from that allocator, here `MemoryPool` of
+ * CustomMemoryManagement.cpp, which returns memory of a buffer on the stack.
+ * How to give the memory back is stored behind the frame.
+ * The benchmarks measure the cost per element (a resume and a suspend per
+ * element, which the compiler can't inline) and the cost of creating many
+ * short generators (where the frame allocation dominates).
+ *
+ * compile using `g++ --std=c++20 -O3`
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <ranges>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = std::chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+// count the allocations on the free store, see CustomMemoryManagement.cpp
+auto allocations = size_t{0};
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (auto p = std::malloc(size)) return p;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+//----------------------------------------------------------------------------------------MemoryPool
+// CustomMemoryManagement.cpp
+
+template <size_t N>
+class MemoryPool {
+public:
+    MemoryPool() noexcept : used_(buffer_) {}
+
+    MemoryPool(MemoryPool const &)            = delete;
+    MemoryPool& operator=(MemoryPool const &) = delete;
+
+    auto reset()       noexcept { used_ = buffer_; }
+    auto used()  const noexcept { return static_cast<size_t>(used_ - buffer_); }
+    static constexpr
+    auto size()        noexcept { return N; }
+
+    auto   allocate(size_t const n)                     -> std::byte*;
+    auto deallocate(std::byte* const p, size_t const n) -> void;
+
+private: // functions
+    static
+    auto align_up(size_t const n) noexcept -> size_t { return (n+alignment-1) & ~(alignment-1); }
+    auto pointer_is_in_buffer(std::byte const * const p) const noexcept -> bool {
+        return std::uintptr_t(p) >= std::uintptr_t(buffer_) &&
+               std::uintptr_t(p) <  std::uintptr_t(buffer_) + N; }
+
+private: // data
+    static constexpr size_t alignment = alignof(max_align_t);
+
+    alignas(alignment) std::byte buffer_[N];
+    std::byte* used_{};
+};
+
+template <size_t N>
+auto MemoryPool<N>::allocate(size_t const n) -> std::byte* {
+    auto const aligned_n = align_up(n);
+    auto const available_bytes = static_cast<decltype(aligned_n)>(buffer_ + N - used_);
+    if (available_bytes >= aligned_n) {
+        auto* result = used_;
+        used_ += aligned_n;
+        return result;
+    }
+    return static_cast<std::byte*>(::operator new(n));
+}
+
+template <size_t N>
+auto MemoryPool<N>::deallocate(std::byte* const p, size_t const n) -> void {
+    if (pointer_is_in_buffer(p)) {
+        auto const aligned_size = align_up(n);
+        if (p + aligned_size == used_)
+            used_ = p;
+    }
+    else ::operator delete(p);
+}
+
+// the free store, for comparison
+struct NewDelete {
+    auto allocate(size_t const n) -> std::byte* { return static_cast<std::byte*>(::operator new(n)); }
+    auto deallocate(std::byte* const p, size_t) -> void { ::operator delete(p); }
+};
+
+template <typename A>
+concept FrameAllocator = requires(A & allocator, std::byte* p, size_t n) {
+    { allocator.allocate(n) } -> std::same_as<std::byte*>;
+    allocator.deallocate(p, n);
+};
+
+//-----------------------------------------------------------------------------------------generator
+
+template <typename T>
+class [[nodiscard]] generator : public std::ranges::view_interface<generator<T>> {
+    static_assert(!std::is_reference_v<T>, "generator<T> yields values");
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+    class iterator;
+
+    generator(generator && other) noexcept : coroutine_{std::exchange(other.coroutine_, {})} {}
+    generator& operator=(generator && other) noexcept { std::swap(coroutine_, other.coroutine_); return *this; }
+    ~generator() { if (coroutine_) coroutine_.destroy(); }
+
+    iterator begin();  // runs the body up to the first `co_yield`
+    std::default_sentinel_t end() const noexcept { return {}; }
+
+private:
+    explicit generator(Handle coroutine) noexcept : coroutine_{coroutine} {}
+
+    Handle coroutine_;
+};
+
+template <typename T>
+struct generator<T>::promise_type {
+    auto get_return_object() noexcept { return generator{Handle::from_promise(*this)}; }
+
+    auto initial_suspend() const noexcept { return std::suspend_always{}; }  // lazy
+    auto final_suspend()   const noexcept { return std::suspend_always{}; }
+
+    // the yielded object lives in the frame until the coroutine is resumed
+    auto yield_value(T const & value) noexcept { value_ = std::addressof(value); return std::suspend_always{}; }
+    auto yield_value(T && value)      noexcept { value_ = std::addressof(value); return std::suspend_always{}; }
+
+    void return_void() const noexcept {}
+    void unhandled_exception() noexcept { exception_ = std::current_exception(); }
+
+    template <typename U>
+    void await_transform(U &&) = delete;  // a generator doesn't `co_await`
+
+    void rethrow() {
+        if (exception_) std::rethrow_exception(std::exchange(exception_, nullptr));
+    }
+
+    // frame allocation: `Deallocate` behind the frame remembers where the memory came from
+    struct Deallocate {
+        void (*deallocate)(void* allocator, std::byte* p, size_t n);
+        void* allocator;
+    };
+
+    static size_t offset(size_t const size) noexcept {
+        return (size + alignof(Deallocate) - 1) & ~(alignof(Deallocate) - 1);
+    }
+
+    template <FrameAllocator A>
+    static void* allocate(size_t const size, A & allocator) {
+        auto const frame = allocator.allocate(offset(size) + sizeof(Deallocate));
+        ::new (frame + offset(size)) Deallocate{
+            [](void* a, std::byte* p, size_t n) { static_cast<A*>(a)->deallocate(p, n); }, &allocator};
+        return frame;
+    }
+
+    static void* operator new(size_t const size) {
+        static auto heap = NewDelete{};
+        return allocate(size, heap);
+    }
+
+    template <FrameAllocator A, typename... Args>
+    static void* operator new(size_t const size, std::allocator_arg_t, A & allocator, Args const & ...) {
+        return allocate(size, allocator);
+    }
+
+    static void operator delete(void* const p, size_t const size) noexcept {
+        auto const frame = static_cast<std::byte*>(p);
+        auto const & d = *std::launder(reinterpret_cast<Deallocate*>(frame + offset(size)));
+        d.deallocate(d.allocator, frame, offset(size) + sizeof(Deallocate));
+    }
+
+    T const * value_ = nullptr;
+    std::exception_ptr exception_;
+};
+
+template <typename T>
+class generator<T>::iterator {
+public:
+    using iterator_concept = std::input_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+
+    T const & operator*() const noexcept { return *coroutine_.promise().value_; }
+
+    iterator& operator++() {
+        coroutine_.resume();
+        coroutine_.promise().rethrow();
+        return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    friend bool operator==(iterator const & it, std::default_sentinel_t) noexcept {
+        return !it.coroutine_ || it.coroutine_.done();
+    }
+
+private:
+    friend class generator;
+    explicit iterator(Handle coroutine) noexcept : coroutine_{coroutine} {}
+
+    Handle coroutine_;
+};
+
+template <typename T>
+auto generator<T>::begin() -> iterator {
+    if (coroutine_ && !coroutine_.done()) {
+        coroutine_.resume();
+        coroutine_.promise().rethrow();
+    }
+    return iterator{coroutine_};
+}
+
+static_assert(std::ranges::input_range<generator<int>>);
+static_assert(std::ranges::view<generator<int>>);
+static_assert(!std::ranges::forward_range<generator<int>>);
+
+//---------------------------------------------------------------------------------------------Points
+
+struct Point {
+    int x, y;
+    double time;
+};
+
+// a linear congruential generator, cheap compared to a resume
+constexpr auto nextState(std::uint32_t const state) noexcept { return state * 1664525u + 1013904223u; }
+constexpr auto toPoint(std::uint32_t const state) noexcept {
+    return Point{static_cast<int>(state >> 20), static_cast<int>(state & 0xfff), static_cast<double>(state >> 29)};
+}
+
+generator<Point> random_points(std::uint32_t seed, std::size_t n) {
+    for (auto i = std::size_t{0}; i < n; ++i) {
+        seed = nextState(seed);
+        co_yield toPoint(seed);
+    }
+}
+
+// the same by hand
+class RandomPoints {
+public:
+    RandomPoints(std::uint32_t seed, std::size_t n) noexcept : seed_{seed}, n_{n} {}
+
+    class iterator {
+    public:
+        using iterator_concept = std::input_iterator_tag;
+        using value_type = Point;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        iterator(std::uint32_t seed, std::size_t n) noexcept
+            : state_{nextState(seed)}, point_{toPoint(state_)}, remaining_{n} {}
+
+        Point const & operator*() const noexcept { return point_; }
+        iterator& operator++() noexcept {
+            state_ = nextState(state_);
+            point_ = toPoint(state_);
+            --remaining_;
+            return *this;
+        }
+        void operator++(int) noexcept { ++*this; }
+
+        friend bool operator==(iterator const & it, std::default_sentinel_t) noexcept { return it.remaining_ == 0; }
+
+    private:
+        std::uint32_t state_ = 0;
+        Point point_{};
+        std::size_t remaining_ = 0;
+    };
+
+    auto begin() const noexcept { return iterator{seed_, n_}; }
+    auto end() const noexcept { return std::default_sentinel; }
+
+private:
+    std::uint32_t seed_;
+    std::size_t n_;
+};
+
+// a streaming source: one point per line "x y time"
+generator<Point> parse_points(std::istream & in) {
+    auto line = std::string{};
+    while (std::getline(in, line)) {
+        auto fields = std::istringstream{line};
+        auto p = Point{};
+        if (!(fields >> p.x >> p.y >> p.time)) throw std::runtime_error{"invalid point: " + line};
+        co_yield p;
+    }
+}
+
+// many short generators
+template <FrameAllocator A>
+generator<int> countdown(std::allocator_arg_t, A &, int from) {
+    for (auto i = from; i > 0; --i) co_yield i;
+}
+
+//------------------------------------------------------------------------------------------Pipeline
+
+// Ranges01.cpp
+auto max_value(std::ranges::forward_range auto&& range) {
+    const auto it = std::ranges::max_element(range);
+    return it != std::end(range) ? *it : 0;
+}
+
+// a single pass: keep the value, not an iterator
+template <std::ranges::input_range R>
+    requires (!std::ranges::forward_range<R>)
+auto max_value(R&& range) {
+    auto result = std::optional<std::ranges::range_value_t<R>>{};
+    for (auto&& value : range)
+        if (!result || *result < value) result = value;
+    return result ? *result : 0;
+}
+
+auto get_max_x(auto&& points) {
+    auto const in_time = [](auto&& p){ return 2.0 <= p.time && p.time <= 3.0; };
+    return max_value(std::forward<decltype(points)>(points) | std::views::filter(in_time)
+                                                            | std::views::transform(&Point::x));
+}
+
+//---------------------------------------------------------------------------------------------Try It
+
+template <typename A>
+auto countdowns(char const * name, A & allocator, int n) {
+    auto const before = allocations;
+    auto sum = 0ll;
+    {
+        ScopedTimer t{name};
+        for (auto i = 0; i < n; ++i)
+            for (auto value : countdown(std::allocator_arg, allocator, i % 4))
+                sum += value;
+    }
+    std::cout << "  " << allocations - before << " allocations\n";
+    return sum;
+}
+
+int main() {
+    auto input = std::istringstream{"1 -1 1.0\n2 -2 2.0\n3 -3 3.0\n4 -4 4.0\n"};
+    cout << get_max_x(parse_points(input)) << '\n';  // 3, like Ranges01.cpp
+
+    auto invalid = std::istringstream{"1 -1 1.0\nthree -3 3.0\n"};
+    try { cout << get_max_x(parse_points(invalid)) << '\n'; }
+    catch (std::exception const & e) { cout << e.what() << '\n'; }  // invalid point: three -3 3.0
+
+    for (auto x : random_points(1, 5) | std::views::transform(&Point::x)) cout << x << ' ';
+    cout << '\n';
+    for (auto x : RandomPoints(1, 5) | std::views::transform(&Point::x)) cout << x << ' ';  // the same
+    cout << '\n';
+
+    // per element: a resume costs about 4ns more than an inlined ++it, still cheaper than filling a vector
+    constexpr auto n = std::size_t{20'000'000};
+    auto result = 0;
+    {
+        ScopedTimer t{"generator       "};  // 2015369us, -O3: 282427us
+        result += get_max_x(random_points(42, n));
+    }
+    {
+        ScopedTimer t{"hand written    "};  // 1706614us, -O3: 201870us
+        result += get_max_x(RandomPoints(42, n));
+    }
+    {
+        ScopedTimer t{"vector          "};  // 2809961us, -O3: 415800us, and 320MB of memory
+        auto points = vector<Point>{};
+        points.reserve(n);
+        for (auto p : RandomPoints(42, n)) points.push_back(p);
+        result += get_max_x(points);
+    }
+    cout << result << '\n';
+
+    // per generator, each yields 0 to 3 values
+    auto heap = NewDelete{};
+    auto pool = MemoryPool<1024>{};
+    auto const sum1 = countdowns("1'000'000 generators, new/delete", heap, 1'000'000);  // 259038us, -O3: 31916us
+    auto const sum2 = countdowns("1'000'000 generators, MemoryPool", pool, 1'000'000);  // 231292us, -O3: 17240us
+    cout << sum1 << ' ' << sum2 << ' ' << pool.used() << '\n';
+}
@@ -0,0 +1,374 @@
+/* Streaming range sources for Point files larger than memory
+ *
+ * ranges, input range, streaming, double buffering, read-ahead, mmap, bounded memory, throughput
+ *
+ * motivation: Ranges01.cpp
+ *
+ * Ranges01.cpp runs `filter | transform | max_value` on a `vector<Point>`
+ * that holds all points in memory. Here the points come from a binary file
+ * (the `Point` structs, back to back) through two range sources that run the
+ * same pipeline with bounded memory, no matter how large the file is:
+ *  - `ChunkedPointFile` reads the file in chunks of `chunkSize` points on a
+ *    background thread into two buffers. While the pipeline works on one
+ *    buffer, the reader fills the other one (double buffering), so reading
+ *    and processing overlap. Memory: 2 * chunkSize * sizeof(Point).
+ *    It is an input range: its iterator can only be advanced once, since a
+ *    buffer is handed back to the reader as soon as the iterator leaves it.
+ *  - `MappedPointFile` maps the file into memory with `mmap`. It is a
+ *    contiguous range of points, the kernel pages them in on demand (with
+ *    read-ahead because of `madvise(MADV_SEQUENTIAL)`) and may drop them when
+ *    memory gets tight. No copies, but a page fault every few pages.
+ * `std::ranges::max_element` needs a forward range, so `max_value` has an
+ * overload for input ranges; `get_max_x` itself is unchanged.
+ * Throughput is reported in MB/s, once with the file dropped from the page
+ * cache (read from disk) and once warm (read from memory).
+ *
+ * usage: `Ranges_StreamingSource [megabytes] [file]`, by default 64 MB in the
+ * temporary directory; the file is created and removed again, also on errors.
+ * Use a file larger than the RAM to see the disk, the table is for 2048 MB.
+ *
+ * compile using `g++ --std=c++20 -O3 -pthread`
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+struct Point {
+    int x, y;
+    double time;
+};
+
+//----------------------------------------------------------------------------------ChunkedPointFile
+
+class ChunkedPointFile {
+public:
+    explicit ChunkedPointFile(std::filesystem::path const & path, std::size_t chunkSize = 64 * 1024);
+    ~ChunkedPointFile();
+
+    ChunkedPointFile(ChunkedPointFile const &)            = delete;
+    ChunkedPointFile& operator=(ChunkedPointFile const &) = delete;
+
+    class iterator;
+    iterator begin();  // once
+    std::default_sentinel_t end() const noexcept { return {}; }
+
+private:
+    struct Chunk {
+        std::vector<Point> points;
+        std::size_t size = 0;
+        bool full = false;  // owned by the reader while false, by the iterator while true
+    };
+
+    void read(std::ifstream file);
+    Chunk const * acquire();  // the next full chunk, nullptr at the end of the file
+    void release();
+
+    std::array<Chunk, 2> chunks_;
+    std::size_t current_ = 0;
+    bool started_ = false;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    bool endOfFile_ = false;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    std::thread reader_;
+};
+
+class ChunkedPointFile::iterator {
+public:
+    using iterator_concept = std::input_iterator_tag;
+    using value_type = Point;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+
+    Point const & operator*() const noexcept { return *position_; }
+
+    iterator& operator++() {
+        if (++position_ == end_) next();
+        return *this;
+    }
+    void operator++(int) { ++*this; }
+
+    friend bool operator==(iterator const & it, std::default_sentinel_t) noexcept { return it.position_ == nullptr; }
+
+private:
+    friend class ChunkedPointFile;
+    explicit iterator(ChunkedPointFile* file) : file_{file} { next(); }
+
+    void next() {
+        if (position_) file_->release();
+        auto const chunk = file_->acquire();
+        position_ = chunk ? chunk->points.data() : nullptr;
+        end_ = chunk ? position_ + chunk->size : nullptr;
+    }
+
+    ChunkedPointFile* file_ = nullptr;
+    Point const * position_ = nullptr;
+    Point const * end_ = nullptr;
+};
+
+static_assert(std::ranges::input_range<ChunkedPointFile>);
+static_assert(!std::ranges::forward_range<ChunkedPointFile>);
+
+ChunkedPointFile::ChunkedPointFile(std::filesystem::path const & path, std::size_t chunkSize) {
+    auto file = std::ifstream{path, std::ios::binary};
+    if (!file) throw std::system_error{errno, std::generic_category(), "can't open " + path.string()};
+    for (auto & chunk : chunks_) chunk.points.resize(std::max<std::size_t>(chunkSize, 1));
+    reader_ = std::thread{[this, file = std::move(file)] () mutable { read(std::move(file)); }};
+}
+
+ChunkedPointFile::~ChunkedPointFile() {
+    {
+        auto lock = std::scoped_lock{mutex_};
+        stop_ = true;
+    }
+    changed_.notify_all();
+    reader_.join();
+}
+
+auto ChunkedPointFile::begin() -> iterator {
+    if (std::exchange(started_, true)) throw std::logic_error{"ChunkedPointFile can be iterated once only"};
+    return iterator{this};
+}
+
+void ChunkedPointFile::read(std::ifstream file) {
+    try {
+        for (auto index = std::size_t{0}; ; index ^= 1) {
+            auto & chunk = chunks_[index];
+            {
+                auto lock = std::unique_lock{mutex_};
+                changed_.wait(lock, [&] { return stop_ || !chunk.full; });
+                if (stop_) return;
+            }
+            // without the lock: the iterator doesn't touch a chunk that isn't full
+            file.read(reinterpret_cast<char*>(chunk.points.data()),
+                      static_cast<std::streamsize>(chunk.points.size() * sizeof(Point)));
+            auto const bytes = static_cast<std::size_t>(file.gcount());
+            if (bytes % sizeof(Point) != 0) throw std::runtime_error{"truncated point file"};
+            if (bytes == 0) break;
+            {
+                auto lock = std::scoped_lock{mutex_};
+                chunk.size = bytes / sizeof(Point);
+                chunk.full = true;
+            }
+            changed_.notify_all();
+        }
+    }
+    catch (...) {
+        auto lock = std::scoped_lock{mutex_};
+        error_ = std::current_exception();
+    }
+    {
+        auto lock = std::scoped_lock{mutex_};
+        endOfFile_ = true;
+    }
+    changed_.notify_all();
+}
+
+auto ChunkedPointFile::acquire() -> Chunk const * {
+    auto & chunk = chunks_[current_];
+    auto lock = std::unique_lock{mutex_};
+    changed_.wait(lock, [&] { return chunk.full || endOfFile_; });
+    if (chunk.full) return &chunk;  // the reader fills the chunks in order, even after the end was seen
+    if (error_) std::rethrow_exception(error_);
+    return nullptr;
+}
+
+void ChunkedPointFile::release() {
+    {
+        auto lock = std::scoped_lock{mutex_};
+        chunks_[current_].full = false;
+    }
+    changed_.notify_all();
+    current_ ^= 1;
+}
+
+//-----------------------------------------------------------------------------------MappedPointFile
+
+class MappedPointFile {
+public:
+    explicit MappedPointFile(std::filesystem::path const & path);
+    ~MappedPointFile();
+
+    MappedPointFile(MappedPointFile const &)            = delete;
+    MappedPointFile& operator=(MappedPointFile const &) = delete;
+
+    Point const * begin() const noexcept { return points_.data(); }
+    Point const * end() const noexcept { return points_.data() + points_.size(); }
+
+private:
+    void* address_ = nullptr;
+    std::size_t bytes_ = 0;
+    std::span<Point const> points_;
+};
+
+MappedPointFile::MappedPointFile(std::filesystem::path const & path) {
+    auto const fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::system_error{errno, std::generic_category(), "can't open " + path.string()};
+    bytes_ = std::filesystem::file_size(path);
+    if (bytes_ % sizeof(Point) != 0) {
+        ::close(fd);
+        throw std::runtime_error{"truncated point file"};
+    }
+    if (bytes_ > 0) {
+        address_ = ::mmap(nullptr, bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+        auto const error = errno;
+        ::close(fd);  // the mapping keeps the file open
+        if (address_ == MAP_FAILED) throw std::system_error{error, std::generic_category(), "mmap"};
+        ::madvise(address_, bytes_, MADV_SEQUENTIAL);
+        points_ = {static_cast<Point const *>(address_), bytes_ / sizeof(Point)};
+    }
+    else ::close(fd);
+}
+
+MappedPointFile::~MappedPointFile() {
+    if (address_) ::munmap(address_, bytes_);
+}
+
+static_assert(std::ranges::contiguous_range<MappedPointFile const &>);
+
+//------------------------------------------------------------------------------------------Pipeline
+
+// Ranges01.cpp
+auto max_value(std::ranges::forward_range auto&& range) {
+    const auto it = std::ranges::max_element(range);
+    return it != std::end(range) ? *it : 0;
+}
+
+// a single pass: keep the value, not an iterator
+template <std::ranges::input_range R>
+    requires (!std::ranges::forward_range<R>)
+auto max_value(R&& range) {
+    auto result = std::optional<std::ranges::range_value_t<R>>{};
+    for (auto&& value : range)
+        if (!result || *result < value) result = value;
+    return result ? *result : 0;
+}
+
+auto get_max_x(auto&& points) {
+    auto const in_time = [](auto&& p){ return 2.0 <= p.time && p.time <= 3.0; };
+    return max_value(points | std::views::filter(in_time) | std::views::transform(&Point::x));
+}
+
+//---------------------------------------------------------------------------------------------Files
+
+// writes `n` random points in chunks and returns the expected result of `get_max_x`
+auto writePointFile(std::filesystem::path const & path, std::size_t n) {
+    auto out = std::ofstream{path, std::ios::binary | std::ios::trunc};
+    if (!out) throw std::system_error{errno, std::generic_category(), "can't create " + path.string()};
+    auto engine = std::mt19937{42};
+    auto coordinate = std::uniform_int_distribution{-1'000'000, 1'000'000};
+    auto time = std::uniform_real_distribution{0.0, 5.0};
+    auto chunk = std::vector<Point>(64 * 1024);
+    auto expected = std::optional<int>{};
+    for (auto written = std::size_t{0}; written < n; written += chunk.size()) {
+        chunk.resize(std::min(chunk.size(), n - written));
+        for (auto & p : chunk) {
+            p = Point{coordinate(engine), coordinate(engine), time(engine)};
+            if (2.0 <= p.time && p.time <= 3.0 && (!expected || *expected < p.x)) expected = p.x;
+        }
+        out.write(reinterpret_cast<char const *>(chunk.data()), static_cast<std::streamsize>(chunk.size() * sizeof(Point)));
+    }
+    if (!out.flush()) throw std::runtime_error{"can't write " + path.string()};
+    return expected.value_or(0);
+}
+
+// so the next read comes from the disk, not from memory
+void dropFromPageCache(std::filesystem::path const & path) {
+    auto const fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    ::fdatasync(fd);  // only clean pages can be dropped
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+}
+
+//---------------------------------------------------------------------------------------------Try It
+
+template <typename F>
+void throughput(char const * name, std::uintmax_t bytes, int expected, F run) {
+    auto const start = std::chrono::steady_clock::now();
+    auto const result = run();
+    auto const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ": " << result << (result == expected ? "" : " (wrong)") << ", "
+              << static_cast<long long>(seconds * 1e6) << "us, "
+              << static_cast<long long>(static_cast<double>(bytes) / 1e6 / seconds) << " MB/s\n";
+}
+
+int main(int argc, char* argv[]) {
+    auto const megabytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 64ull;
+    auto const path = argc > 2 ? std::filesystem::path{argv[2]}
+                               : std::filesystem::temp_directory_path() / ("points-" + std::to_string(::getpid()) + ".bin");
+
+    // Ranges01.cpp: in memory
+    auto points = vector{Point{1, -1, 1.0}, Point{2, -2, 2.0}, Point{3, -3, 3.0}, Point{4, -4, 4.0}};
+    cout << get_max_x(points) << endl;  // 3
+
+    try {
+        auto const expected = writePointFile(path, megabytes * 1'000'000 / sizeof(Point));
+        auto const bytes = std::filesystem::file_size(path);
+        cout << bytes / sizeof(Point) << " points, " << bytes / 1'000'000 << " MB in " << path << '\n';
+
+        for (auto cold : {true, false}) {
+            cout << (cold ? "from disk\n" : "from the page cache\n");
+            if (cold) dropFromPageCache(path);
+            throughput("  chunked, 2 x 64k points", bytes, expected, [&] {
+                auto file = ChunkedPointFile{path};
+                return get_max_x(file);
+            });
+            if (cold) dropFromPageCache(path);
+            throughput("  chunked, 2 x 1k points ", bytes, expected, [&] {
+                auto file = ChunkedPointFile{path, 1024};
+                return get_max_x(file);
+            });
+            if (cold) dropFromPageCache(path);
+            throughput("  mmap                   ", bytes, expected, [&] {
+                auto const file = MappedPointFile{path};
+                return get_max_x(file);
+            });
+        }
+    }
+    catch (std::exception const & e) {
+        cout << e.what() << '\n';
+    }
+    auto ec = std::error_code{};
+    std::filesystem::remove(path, ec);  // also after a partial write
+}
+
+// 2048 MB, single core VM, -O3 (-O0):
+// from disk
+//   chunked, 2 x 64k points:  756 MB/s (145 MB/s)
+//   chunked, 2 x 1k points :  710 MB/s (144 MB/s)
+//   mmap                   : 1184 MB/s (160 MB/s)
+// from the page cache
+//   chunked, 2 x 64k points: 1130 MB/s (177 MB/s)
+//   chunked, 2 x 1k points :  879 MB/s (167 MB/s)
+//   mmap                   : 1339 MB/s (202 MB/s)
+// With one core the reader thread can't really run ahead, the chunks only amortize the
+// synchronization. mmap saves the copy into the buffers. Memory: 2 x 1MB for the chunks.
@@ -0,0 +1,264 @@
+/* polymorphic collection with one contiguous segment per type
+ *
+ * dynamic polymorphism, devirtualization, data oriented design, containers, cache, performance
+ *
+ * motivator: TypeErasure_DynamicPolymorphism.cpp, boost::poly_collection
+ *
+ * `Shapes` in TypeErasure_DynamicPolymorphism.cpp is a vector of
+ * `shared_ptr<Shape>`: every shape is a separate heap allocation, and when
+ * the types are mixed, every virtual call jumps to a different function, so
+ * the branch predictor fails often.
+ * A `poly_collection<Shape>` stores all `Circle`s in one vector, all `Square`s
+ * in the next, and so on. Iterating the collection visits the shapes segment
+ * by segment: the memory is contiguous and all calls in a segment go to the
+ * same function, which is easy to predict.
+ * `for_each<Circle, Square>(f)` goes a step further. For segments of the
+ * listed types `f` is called with the concrete type, so with `final` classes
+ * the compiler resolves (and inlines) the calls statically. Other segments
+ * are still visited via `Shape&`.
+ * `poly_collection<Shape, Circle, Square>` restricts the collection to the
+ * listed types, which are then known everywhere (no virtual calls and no
+ * lookup of segments at all), inserting anything else does not compile.
+ * Note that the order of insertion is not preserved across types.
+ */
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <numbers>
+#include <random>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+//-----------------------------------------------------------------------------------poly_collection
+
+// restricted to `Types...`
+template <typename Base, typename... Types>
+class poly_collection {
+    static_assert((std::is_base_of_v<Base, Types> && ...));
+
+public:
+    template <typename T>
+        requires (std::is_same_v<std::remove_cvref_t<T>, Types> || ...)
+    void insert(T && obj) { segment<std::remove_cvref_t<T>>().push_back(std::forward<T>(obj)); }
+
+    template <typename T, typename... Args>
+    auto emplace(Args&&... args) -> T & { return segment<T>().emplace_back(std::forward<Args>(args)...); }
+
+    template <typename F>
+    void for_each(F && f) {
+        std::apply([&](auto & ... segments) { (for_each_in(segments, f), ...); }, segments_);
+    }
+
+    template <typename T>
+    auto segment() -> vector<T> & { return std::get<vector<T>>(segments_); }
+
+    auto size() const {
+        return std::apply([](auto const & ... segments) { return (segments.size() + ... + 0); }, segments_);
+    }
+
+private:
+    template <typename T, typename F>
+    static void for_each_in(vector<T> & segment, F & f) { for (auto & obj : segment) f(obj); }
+
+    std::tuple<vector<Types>...> segments_;
+};
+
+// open to every type derived from `Base`
+template <typename Base>
+class poly_collection<Base> {
+public:
+    template <typename T>
+        requires std::is_base_of_v<Base, std::remove_cvref_t<T>>
+    void insert(T && obj) { segment<std::remove_cvref_t<T>>().push_back(std::forward<T>(obj)); }
+
+    template <typename T, typename... Args>
+    auto emplace(Args&&... args) -> T & { return segment<T>().emplace_back(std::forward<Args>(args)...); }
+
+    // calls `f(T&)` for segments of the `Known` types, `f(Base&)` for all others
+    template <typename... Known, typename F>
+    void for_each(F && f) {
+        for (auto & segment : segments_) {
+            if (!(visitIf<Known>(*segment, f) || ...)) {
+                auto const [first, stride, size] = segment->bases();
+                for (auto i = std::size_t{0}; i < size; ++i)
+                    f(*reinterpret_cast<Base*>(first + i * stride));
+            }
+        }
+    }
+
+    template <typename T>
+    auto segment() -> vector<T> & {
+        auto const [it, isNew] = index_.try_emplace(typeid(T), segments_.size());
+        if (isNew) segments_.push_back(make_unique<Segment<T>>());
+        return static_cast<Segment<T>&>(*segments_[it->second]).objects;
+    }
+
+    auto size() const {
+        auto size = std::size_t{0};
+        for (auto const & segment : segments_) size += segment->bases().size;
+        return size;
+    }
+
+private:
+    struct SegmentBase {
+        virtual ~SegmentBase() = default;
+        struct Bases { std::byte * first; std::size_t stride, size; };
+        // the `Base` subobjects of the elements are `stride` bytes apart
+        virtual auto bases() const -> Bases = 0;
+        virtual auto type() const -> std::type_index = 0;
+    };
+
+    template <typename T>
+    struct Segment : SegmentBase {
+        auto bases() const -> typename SegmentBase::Bases override {
+            auto const first = objects.empty() ? nullptr : static_cast<Base*>(const_cast<T*>(objects.data()));
+            return {reinterpret_cast<std::byte*>(first), sizeof(T), objects.size()};
+        }
+        auto type() const -> std::type_index override { return typeid(T); }
+        vector<T> objects;
+    };
+
+    template <typename T, typename F>
+    static bool visitIf(SegmentBase & segment, F & f) {
+        if (segment.type() != typeid(T)) return false;
+        for (auto & obj : static_cast<Segment<T>&>(segment).objects) f(obj);
+        return true;
+    }
+
+    vector<unique_ptr<SegmentBase>> segments_;
+    std::unordered_map<std::type_index, std::size_t> index_;
+};
+
+//----------------------------------------------------------------------------------------------Shapes
+// as in TypeErasure_DynamicPolymorphism.cpp, with some data
+
+struct Shape {
+    virtual ~Shape() = default;
+    virtual string typeString() const = 0;
+    virtual double area() const = 0;
+};
+
+struct Circle final : Shape {
+    explicit Circle(double r) : radius{r} {}
+    string typeString() const override { return "Circle"; }
+    double area() const override { return std::numbers::pi * radius * radius; }
+    double radius;
+};
+
+struct Square final : Shape {
+    explicit Square(double s) : side{s} {}
+    string typeString() const override { return "Square"; }
+    double area() const override { return side * side; }
+    double side;
+};
+
+struct Triangle final : Shape {
+    Triangle(double b, double h) : base{b}, height{h} {}
+    string typeString() const override { return "Triangle"; }
+    double area() const override { return base * height / 2; }
+    double base, height;
+};
+
+using Shapes = vector<shared_ptr<Shape>>;
+
+//--------------------------------------------------------------------------------------------Try It
+
+constexpr auto numShapes = 1'000'000;
+constexpr auto repetitions = 20;
+
+// the same random shapes for every collection
+template <typename AddCircle, typename AddSquare, typename AddTriangle>
+void fill(AddCircle addCircle, AddSquare addSquare, AddTriangle addTriangle) {
+    auto engine = std::mt19937{42};
+    for (auto i = 0; i < numShapes; ++i) {
+        auto const size = 1.0 + engine() % 10;
+        switch (engine() % 3) {
+            case 0:  addCircle(size);   break;
+            case 1:  addSquare(size);   break;
+            default: addTriangle(size); break;
+        }
+    }
+}
+
+int main() {
+    {
+        auto shapes = poly_collection<Shape>{};
+        shapes.insert(Square{1});
+        shapes.insert(Circle{1});
+        shapes.insert(Square{2});
+        shapes.for_each([](Shape const & s) { cout << s.typeString() << ' '; });  // Square Square Circle
+        cout << '\n';
+    }
+
+    auto shapes = Shapes{};
+    fill([&](double s) { shapes.push_back(make_shared<Circle>(s)); },
+         [&](double s) { shapes.push_back(make_shared<Square>(s)); },
+         [&](double s) { shapes.push_back(make_shared<Triangle>(s, s)); });
+    auto shuffled = shapes;  // as after a while of inserting and erasing
+    std::shuffle(std::begin(shuffled), std::end(shuffled), std::mt19937{7});
+
+    auto open = poly_collection<Shape>{};
+    fill([&](double s) { open.emplace<Circle>(s); },
+         [&](double s) { open.emplace<Square>(s); },
+         [&](double s) { open.emplace<Triangle>(s, s); });
+
+    auto restricted = poly_collection<Shape, Circle, Square, Triangle>{};
+    fill([&](double s) { restricted.emplace<Circle>(s); },
+         [&](double s) { restricted.emplace<Square>(s); },
+         [&](double s) { restricted.emplace<Triangle>(s, s); });
+    // restricted.insert(Banana{});  // does not compile
+
+    auto const sum_areas = [](char const * name, auto && for_each) {
+        auto sum = 0.0;
+        {
+            ScopedTimer t{name};
+            for (auto i = 0; i < repetitions; ++i)
+                for_each([&](auto const & shape) { sum += shape.area(); });
+        }
+        cout << "  " << sum << '\n';
+    };
+
+    sum_areas("vector<shared_ptr>",           // 630766us, -O3: 322959us
+              [&](auto f) { for (auto const & s : shapes) f(*s); });
+    sum_areas("vector<shared_ptr> shuffled",  // 2022578us, -O3: 660937us
+              [&](auto f) { for (auto const & s : shuffled) f(*s); });
+    sum_areas("poly_collection",              // 129529us, -O3:  90519us
+              [&](auto f) { open.for_each(f); });
+    sum_areas("poly_collection known types",  // 225150us, -O3:  71631us
+              [&](auto f) { open.for_each<Circle, Square, Triangle>(f); });
+    sum_areas("restricted poly_collection",   // 286834us, -O3:  60421us
+              [&](auto f) { restricted.for_each(f); });
+}
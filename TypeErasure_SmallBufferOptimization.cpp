@@ -0,0 +1,297 @@
+/* duck typing with small buffer optimization and value semantics
+ *
+ * duck typing, type erasure, small buffer optimization, value semantics, vtable, allocation, performance
+ *
+ * motivator: TypeErasure_DuckTyping.cpp, SmallStringOptimization.cpp
+ *
+ * The `PolymorphicWrapper` of TypeErasure_DuckTyping.cpp allocates every
+ * wrapped object with `make_shared`. Copying the wrapper copies the pointer
+ * only, so copies share (and modify) the same object, and every copy pays
+ * for an atomic reference count.
+ * `BasicPolymorphicWrapper<BufferSize, Alignment>` stores objects that fit
+ * into its inline buffer (and have a non-throwing move constructor) in
+ * place, just like std::string does with short strings. Only larger objects
+ * are put on the heap. Instead of a `Concept` base class with virtual
+ * functions, every wrapped type gets a static table of function pointers
+ * (the hand-rolled vtable), which also knows how to copy, move and destroy
+ * the object. Copies are deep copies, so the wrapper behaves like a value.
+ * The price: sizeof(wrapper) grows with the buffer, and moving a wrapper
+ * moves the object instead of a pointer.
+ */
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <numbers>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+using namespace std;
+
+//----------------------------------------------------------------------------------------------Misc
+// Small class for crude benchmarking, see ScopedTimer.cpp
+class ScopedTimer {
+public:
+    using ClockType = chrono::steady_clock;
+    explicit ScopedTimer(char const * function_name)
+        : function_name_{function_name}
+        , start_{ClockType::now()} {}
+
+    ScopedTimer(ScopedTimer const & ) = delete;
+    ScopedTimer(ScopedTimer       &&) = delete;
+    ScopedTimer& operator=(ScopedTimer const & ) = delete;
+    ScopedTimer& operator=(ScopedTimer       &&) = delete;
+
+    ~ScopedTimer() {
+        using namespace std::chrono;
+        auto const stop = ClockType::now();
+        auto const duration = stop - start_;
+        auto const us = duration_cast<microseconds>(duration).count();
+        std::cout << us << "us " << function_name_ << '\n';
+    }
+
+private:
+    char const * const function_name_;
+    ClockType::time_point const start_;
+};
+
+// count allocations, see SmallStringOptimization.cpp
+auto allocations = size_t{0};
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (auto p = std::malloc(size)) return p;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+//-------------------------------------------------------------------------------------------Concept
+
+template <typename T>
+concept Shape = std::copy_constructible<T> && requires (T const& obj, T& mutableObj, double factor) {
+    { obj.typeAsString() } -> std::same_as<std::string>;
+    { obj.area() } -> std::same_as<double>;
+    mutableObj.scale(factor);
+};
+
+//------------------------------------------------------------------------------SharedPolymorphicWrapper
+// as in TypeErasure_DuckTyping.cpp, for comparison
+
+struct SharedPolymorphicWrapper {
+    template <typename T>
+        requires (!std::is_same_v<T, SharedPolymorphicWrapper>) && Shape<T>
+    SharedPolymorphicWrapper(T const & obj) : wrapped_{make_shared<Model<T>>(obj)} {}
+
+    string typeAsString() const { return wrapped_->typeAsString(); }
+    double area() const { return wrapped_->area(); }
+    void scale(double factor) { wrapped_->scale(factor); }
+
+private:
+    struct Concept {
+        virtual ~Concept() = default;
+        virtual string typeAsString() const = 0;
+        virtual double area() const = 0;
+        virtual void scale(double factor) = 0;
+    };
+
+    template <Shape T>
+    struct Model : Concept {
+        Model(T const & obj) : object_{obj} {}
+        string typeAsString() const override { return object_.typeAsString(); }
+        double area() const override { return object_.area(); }
+        void scale(double factor) override { object_.scale(factor); }
+    private:
+        T object_;
+    };
+
+    std::shared_ptr<Concept> wrapped_;
+};
+
+//-------------------------------------------------------------------------------PolymorphicWrapper
+
+template <std::size_t BufferSize, std::size_t Alignment = alignof(std::max_align_t)>
+class BasicPolymorphicWrapper {
+public:
+    template <typename T>
+        requires (!std::is_same_v<T, BasicPolymorphicWrapper>) && Shape<T>
+    BasicPolymorphicWrapper(T const & obj) : vtable_{&vtableFor<T>} {
+        if constexpr (fitsInline<T>) ::new (static_cast<void*>(buffer_)) T(obj);
+        else ::new (static_cast<void*>(buffer_)) T*(new T(obj));
+    }
+
+    BasicPolymorphicWrapper(BasicPolymorphicWrapper const & other) : vtable_{other.vtable_} {
+        vtable_->copy(other.buffer_, buffer_);
+    }
+
+    BasicPolymorphicWrapper(BasicPolymorphicWrapper && other) noexcept : vtable_{other.vtable_} {
+        vtable_->move(other.buffer_, buffer_);
+    }
+
+    BasicPolymorphicWrapper& operator=(BasicPolymorphicWrapper const & other) {
+        if (this != &other) {
+            auto copy = other;        // may throw, leaves *this untouched
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    BasicPolymorphicWrapper& operator=(BasicPolymorphicWrapper && other) noexcept {
+        if (this != &other) {
+            vtable_->destroy(buffer_);
+            vtable_ = other.vtable_;
+            vtable_->move(other.buffer_, buffer_);
+        }
+        return *this;
+    }
+
+    ~BasicPolymorphicWrapper() { vtable_->destroy(buffer_); }
+
+    string typeAsString() const { return vtable_->typeAsString(buffer_); }
+    double area() const { return vtable_->area(buffer_); }
+    void scale(double factor) { vtable_->scale(buffer_, factor); }
+
+    // true if the object lives in the inline buffer
+    bool isInline() const noexcept { return vtable_->isInline; }
+
+private:
+    template <typename T>
+    static constexpr bool fitsInline = sizeof(T) <= BufferSize && Alignment % alignof(T) == 0
+                                       && std::is_nothrow_move_constructible_v<T>;
+
+    // A moved-from wrapper keeps its vtable, it may only be destroyed or assigned to
+    struct VTable {
+        string (*typeAsString)(std::byte const * buffer);
+        double (*area)(std::byte const * buffer);
+        void (*scale)(std::byte * buffer, double factor);
+        void (*copy)(std::byte const * from, std::byte * to);
+        void (*move)(std::byte * from, std::byte * to) noexcept;
+        void (*destroy)(std::byte * buffer) noexcept;
+        bool isInline;
+    };
+
+    template <typename T>
+    static T& object(std::byte * buffer) {
+        if constexpr (fitsInline<T>) return *std::launder(reinterpret_cast<T*>(buffer));
+        else return **std::launder(reinterpret_cast<T**>(buffer));
+    }
+
+    template <typename T>
+    static T const & object(std::byte const * buffer) { return object<T>(const_cast<std::byte*>(buffer)); }
+
+    template <typename T>
+    static constexpr VTable vtableFor{
+        [](std::byte const * buffer) { return object<T>(buffer).typeAsString(); },
+        [](std::byte const * buffer) { return object<T>(buffer).area(); },
+        [](std::byte * buffer, double factor) { object<T>(buffer).scale(factor); },
+        [](std::byte const * from, std::byte * to) {
+            if constexpr (fitsInline<T>) ::new (static_cast<void*>(to)) T(object<T>(from));
+            else ::new (static_cast<void*>(to)) T*(new T(object<T>(from)));
+        },
+        [](std::byte * from, std::byte * to) noexcept {
+            if constexpr (fitsInline<T>) ::new (static_cast<void*>(to)) T(std::move(object<T>(from)));
+            else ::new (static_cast<void*>(to)) T*(std::exchange(*std::launder(reinterpret_cast<T**>(from)), nullptr));
+        },
+        [](std::byte * buffer) noexcept {
+            if constexpr (fitsInline<T>) object<T>(buffer).~T();
+            else delete *std::launder(reinterpret_cast<T**>(buffer));
+        },
+        fitsInline<T>
+    };
+
+    VTable const * vtable_;
+    alignas(Alignment) std::byte buffer_[std::max(BufferSize, sizeof(void*))];
+};
+
+using PolymorphicWrapper = BasicPolymorphicWrapper<24, alignof(double)>;  // 32 bytes
+
+//----------------------------------------------------------------------------------------------Shapes
+
+struct Circle {
+    string typeAsString() const { return "Circle"; }
+    double area() const { return std::numbers::pi * radius * radius; }
+    void scale(double factor) { radius *= factor; }
+    double radius = 1.0;
+};
+
+struct Square {
+    string typeAsString() const { return "Square"; }
+    double area() const { return side * side; }
+    void scale(double factor) { side *= factor; }
+    double side = 1.0;
+};
+
+// too large for the inline buffer
+struct Polygon {
+    string typeAsString() const { return "Polygon"; }
+    double area() const {  // shoelace formula
+        auto sum = 0.0;
+        for (auto i = std::size_t{0}; i < x.size(); ++i) {
+            auto const j = (i + 1) % x.size();
+            sum += x[i] * y[j] - x[j] * y[i];
+        }
+        return sum / 2;
+    }
+    void scale(double factor) {
+        for (auto & c : x) c *= factor;
+        for (auto & c : y) c *= factor;
+    }
+    array<double, 4> x{0, 1, 1, 0}, y{0, 0, 1, 1};
+};
+
+//--------------------------------------------------------------------------------------------Try It
+
+template <typename Wrapper>
+auto total_area(vector<Wrapper> const & shapes) {
+    auto sum = 0.0;
+    for (auto const & shape : shapes) sum += shape.area();
+    return sum;
+}
+
+template <typename Wrapper>
+void benchmark(char const * name) {
+    allocations = 0;
+    auto shapes = vector<Wrapper>{};
+    shapes.reserve(1'000'000);
+    {
+        ScopedTimer t{name};
+        for (auto i = 0; i < 1'000'000; ++i)
+            if (i % 2) shapes.emplace_back(Circle{}); else shapes.emplace_back(Square{});
+        auto sum = 0.0;
+        for (auto repetition = 0; repetition < 10; ++repetition) sum += total_area(shapes);
+        cout << sum << ", ";
+    }
+    cout << "allocations: " << allocations << '\n';
+}
+
+int main() {
+    cout << "sizeof(PolymorphicWrapper) = " << sizeof(PolymorphicWrapper) << '\n';  // 32
+    auto shapes = vector<PolymorphicWrapper>{ Circle{}, Square{}, Polygon{} };
+    for (auto const & shape : shapes)
+        cout << shape.typeAsString() << (shape.isInline() ? " (inline)" : " (heap)") << '\n';
+
+    // value semantics: copies are independent
+    auto circle = PolymorphicWrapper{Circle{}};
+    auto copy = circle;
+    copy.scale(2);
+    cout << circle.area() << ' ' << copy.area() << '\n';                   // 3.14159 12.5664
+    auto sharedCircle = SharedPolymorphicWrapper{Circle{}};
+    auto sharedCopy = sharedCircle;
+    sharedCopy.scale(2);
+    cout << sharedCircle.area() << ' ' << sharedCopy.area() << '\n';       // 12.5664 12.5664
+
+    auto polygon = PolymorphicWrapper{Polygon{}};
+    auto polygonCopy = polygon;
+    polygonCopy.scale(3);
+    polygon = std::move(polygonCopy);
+    cout << polygon.area() << '\n';                                        // 9
+
+    // 1 allocation for the vector itself
+    benchmark<SharedPolymorphicWrapper>("shared_ptr wrapper");  // 470671us, -O3: 156411us, allocations: 1000001
+    benchmark<PolymorphicWrapper>("small buffer wrapper");      // 269629us, -O3:  68033us, allocations: 1
+}